@@ -1,112 +1,578 @@
 #include "bloom.h"
+#include "counting_engine.h"
+#include "dafsa.h"
+#include "device_tokens.h"
+#include "flat_word_map.h"
+#include "hugepage.h"
+#include "numa.h"
+#include "perfect_hash.h"
+#include "sorted_dictionary.h"
+#include "word_arena.h"
+#include "word_loader.h"
 #include <CLI/CLI.hpp>
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 #include <string.h>
 #include <unistd.h>
 #include <bitset>
+#include <chrono>
+#include <cstdint>
 #include <limits>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
 
 
 using namespace std;
 
 namespace WordCountBloomFilter {
 
-class BloomFilter {
+// Runtime interface over the pre-instantiated filter specializations, so the
+// CLI can pick a hash policy, k and layout without the hot loops paying for it.
+// Hot loops go through the batch calls, which cost one virtual call per batch;
+// inside them the hash and probe loop inline into the token loop.
+class AnyBloomFilter {
 public:
-    BloomFilter(size_t numberOfBits, size_t numberOfHashFunctions)
+    virtual ~AnyBloomFilter() = default;
+
+    virtual void insert(string_view element) = 0;
+    virtual double search(string_view element) = 0;
+    virtual void insertAll(const vector<string_view>& elements) = 0;
+    // hits[i] = 1 when elements[i] may be in the filter, for i in [begin, end);
+    // hits must already hold elements.size() entries. Returns the number of hits.
+    virtual size_t searchAll(const vector<string_view>& elements, size_t begin, size_t end, vector<uint8_t>& hits) = 0;
+    virtual double false_positive_probability() const = 0;
+    virtual int get_collisions() = 0;
+    virtual size_t get_num_bits() const = 0;
+    virtual size_t get_num_hash_funcs() const = 0;
+    virtual int get_num_inserts() const = 0;
+    virtual unique_ptr<AnyBloomFilter> clone() const = 0;
+};
+
+// Hash policies return two 64-bit hashes; the storage layout turns them into
+// k probe positions by double hashing.
+struct Md5Sha256Hash {
+    static pair<uint64_t, uint64_t> hash(string_view word) {
+        std::hash<string> strHash;
+
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        MD5(reinterpret_cast<const unsigned char*>(word.data()), word.size(), md5);
+        string str_md5(reinterpret_cast<const char*>(md5), MD5_DIGEST_LENGTH);
+
+        unsigned char sha[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char*>(word.data()), word.size(), sha);
+        string str_sha(reinterpret_cast<const char*>(sha), SHA256_DIGEST_LENGTH);
+
+        return {strHash(str_md5.substr(0, 6)), strHash(str_sha.substr(0, 6))};
+    }
+};
+
+// Much cheaper than the digests; the second hash is a murmur3 finalizer of the first.
+struct Fnv1aHash {
+    static pair<uint64_t, uint64_t> hash(string_view word) {
+        uint64_t hash1 = fnv1a64(word.data(), static_cast<uint32_t>(word.size()));
+        uint64_t hash2 = hash1;
+        hash2 ^= hash2 >> 33;
+        hash2 *= 0xff51afd7ed558ccdull;
+        hash2 ^= hash2 >> 33;
+        hash2 *= 0xc4ceb9fe1a85ec53ull;
+        hash2 ^= hash2 >> 33;
+        return {hash1, hash2};
+    }
+};
+
+// Probes spread over the whole bit array: (h1 + i * h2) mod m.
+class FlatBitStorage {
+public:
+    explicit FlatBitStorage(size_t numberOfBits)
         : numBits(numberOfBits)
-        , numHashFuncs(numberOfHashFunctions)
+        , words((numberOfBits + 63) / 64, 0) {
+    }
+
+    // A step of 0 would put all k probes on one bit, so it becomes 1.
+    size_t probe(uint64_t hash1, uint64_t hash2, size_t i) const {
+        size_t step = hash2 % numBits;
+        return (hash1 % numBits + i * (step == 0 ? 1 : step)) % numBits;
+    }
+
+    bool test(size_t bit) const {
+        return words[bit / 64] & (1ull << (bit % 64));
+    }
+
+    bool testAndSet(size_t bit) {
+        uint64_t mask = 1ull << (bit % 64);
+        bool wasSet = words[bit / 64] & mask;
+        words[bit / 64] |= mask;
+        return wasSet;
+    }
+
+    size_t size() const { return numBits; }
+
+private:
+    size_t numBits;
+    HugePages::HugePageVector<uint64_t> words;
+};
+
+// All k probes of a word land in one 512-bit block, so a lookup touches a
+// single cache line at the cost of a slightly higher false-positive rate.
+class BlockedBitStorage {
+public:
+    static constexpr size_t blockBits = 512;
+
+    explicit BlockedBitStorage(size_t numberOfBits)
+        : numBlocks(max<size_t>(1, (numberOfBits + blockBits - 1) / blockBits))
+        , words(numBlocks * blockBits / 64, 0) {
+    }
+
+    size_t probe(uint64_t hash1, uint64_t hash2, size_t i) const {
+        size_t block = hash1 % numBlocks;
+        return block * blockBits + ((hash2 + i * ((hash1 >> 32) | 1)) % blockBits);
+    }
+
+    bool test(size_t bit) const {
+        return words[bit / 64] & (1ull << (bit % 64));
+    }
+
+    bool testAndSet(size_t bit) {
+        uint64_t mask = 1ull << (bit % 64);
+        bool wasSet = words[bit / 64] & mask;
+        words[bit / 64] |= mask;
+        return wasSet;
+    }
+
+    size_t size() const { return numBlocks * blockBits; }
+
+private:
+    size_t numBlocks;
+    HugePages::HugePageVector<uint64_t> words;
+};
+
+// K = 0 takes the number of hash functions at runtime; any other K fixes it at
+// compile time so the probe loops below are fully unrolled.
+template <typename HashPolicy, size_t K = 0, typename Storage = FlatBitStorage>
+class BloomFilter final : public AnyBloomFilter {
+public:
+    BloomFilter(size_t numberOfBits, size_t numberOfHashFunctions)
+        : data(numberOfBits)
+        , numBits(data.size())
+        , numHashFuncs(K != 0 ? K : numberOfHashFunctions)
         , numInserts(0)
         , collisions(0) {
-            data = make_unique<bitset<numeric_limits<size_t>::max()>>(numBits);
     }
 
-    void insert(const string& element) {
-        vector<size_t> hashes = getHashes(element);
+    void insert(string_view element) override {
+        add(element);
+    }
+
+    double search(string_view element) override {
+        return contains(element) ? false_positive_probability() : -1.0;
+    }
+
+    void insertAll(const vector<string_view>& elements) override {
+        for (string_view element : elements) {
+            add(element);
+        }
+    }
+
+    size_t searchAll(const vector<string_view>& elements, size_t begin, size_t end, vector<uint8_t>& hits) override {
+        size_t numHits = 0;
+        for (size_t i = begin; i < end; i++) {
+            hits[i] = contains(elements[i]);
+            numHits += hits[i];
+        }
+        return numHits;
+    }
+
+    // Theoretical false-positive rate for the current fill, (1 - (1 - 1/m)^(kn))^k.
+    double false_positive_probability() const override {
+        return pow(1.0 - pow(1.0 - 1.0 / numBits, numHashFuncs * numInserts), numHashFuncs);
+    }
+
+    int get_collisions() override { return collisions; }
+    size_t get_num_bits() const override { return numBits; }
+    size_t get_num_hash_funcs() const override { return numHashFuncs; }
+    int get_num_inserts() const override { return numInserts; }
+
+    unique_ptr<AnyBloomFilter> clone() const override {
+        return make_unique<BloomFilter>(*this);
+    }
+
+private:
+    Storage data;
+    size_t numBits;
+    size_t numHashFuncs;
+    int numInserts;
+    int collisions;
+
+    size_t hashCount() const {
+        if constexpr (K != 0) {
+            return K;
+        } else {
+            return numHashFuncs;
+        }
+    }
+
+    void add(string_view element) {
+        auto [hash1, hash2] = HashPolicy::hash(element);
 
-        for (size_t hash : hashes) {
-            if ((*data)[hash]) {
+        for (size_t i = 0; i < hashCount(); i++) {
+            if (data.testAndSet(data.probe(hash1, hash2, i))) {
                 collisions++;
             }
-            (*data)[hash] = true;
         }
 
         numInserts++;
     }
 
-    double search(const string& element) {
-        vector<size_t> hashes = getHashes(element);
+    bool contains(string_view element) const {
+        auto [hash1, hash2] = HashPolicy::hash(element);
 
-        for (size_t hash : hashes) {
-            if (!(*data)[hash]) {
-                return -1.0;
+        for (size_t i = 0; i < hashCount(); i++) {
+            if (!data.test(data.probe(hash1, hash2, i))) {
+                return false;
             }
         }
 
-        double prob = pow(1.0 - pow(1.0 - 1.0 / numBits, numHashFuncs * numInserts), numHashFuncs);
-        return prob;
+        return true;
     }
+};
 
-    int get_collisions() { return collisions; }
+template <typename HashPolicy, typename Storage>
+unique_ptr<AnyBloomFilter> makeBloomFilterWith(size_t numberOfBits, size_t numberOfHashFunctions) {
+    switch (numberOfHashFunctions) {
+    case 3:
+        return make_unique<BloomFilter<HashPolicy, 3, Storage>>(numberOfBits, numberOfHashFunctions);
+    case 5:
+        return make_unique<BloomFilter<HashPolicy, 5, Storage>>(numberOfBits, numberOfHashFunctions);
+    case 7:
+        return make_unique<BloomFilter<HashPolicy, 7, Storage>>(numberOfBits, numberOfHashFunctions);
+    default:
+        return make_unique<BloomFilter<HashPolicy, 0, Storage>>(numberOfBits, numberOfHashFunctions);
+    }
+}
 
-private:
-    size_t numBits;
-    size_t numHashFuncs;
-    unique_ptr<bitset<numeric_limits<size_t>::max()>> data;
-    int numInserts;
-    int collisions;
+template <typename HashPolicy>
+unique_ptr<AnyBloomFilter> makeBloomFilterWith(size_t numberOfBits, size_t numberOfHashFunctions, const string& layout) {
+    if (layout == "blocked") {
+        return makeBloomFilterWith<HashPolicy, BlockedBitStorage>(numberOfBits, numberOfHashFunctions);
+    }
+    return makeBloomFilterWith<HashPolicy, FlatBitStorage>(numberOfBits, numberOfHashFunctions);
+}
 
-    int hashF1(const string& word) {
-        unsigned char md[MD5_DIGEST_LENGTH];
-        MD5(reinterpret_cast<const unsigned char*>(word.c_str()), word.size(), md);
-        hash<string> strHash;
-        string str_md(reinterpret_cast<const char*>(md), MD5_DIGEST_LENGTH);
-        return strHash(str_md.substr(0, 6)) % numBits;
+// Maps the CLI's hash/layout names and --hashf to the best pre-instantiated specialization.
+unique_ptr<AnyBloomFilter> makeBloomFilter(size_t numberOfBits, size_t numberOfHashFunctions,
+                                           const string& hashName, const string& layout) {
+    if (hashName == "fnv1a") {
+        return makeBloomFilterWith<Fnv1aHash>(numberOfBits, numberOfHashFunctions, layout);
     }
+    return makeBloomFilterWith<Md5Sha256Hash>(numberOfBits, numberOfHashFunctions, layout);
+}
 
-    int hashF2(const string& word) {
-        unsigned char md[SHA256_DIGEST_LENGTH];
-        SHA256(reinterpret_cast<const unsigned char*>(word.c_str()), word.size(), md);
-        hash<string> strHash;
-        string str_md(reinterpret_cast<const char*>(md), SHA256_DIGEST_LENGTH);
-        return strHash(str_md.substr(0, 6)) % numBits;
+// Builds words that are guaranteed not to be in the dictionary, for measuring
+// the false-positive rate when the corpus has too few non-dictionary tokens.
+// The words are kept in arena.
+vector<string_view> makeSyntheticNegatives(const SortedDictionary::EytzingerDictionary& dictionary, size_t count,
+                                           size_t minimumWordLength, WordArena::Arena& arena) {
+    vector<string_view> negatives;
+    negatives.reserve(count);
+    mt19937_64 rng(42);
+    uniform_int_distribution<int> letter('A', 'Z');
+    uniform_int_distribution<size_t> length(max<size_t>(minimumWordLength, 4), max<size_t>(minimumWordLength, 12));
+
+    while (negatives.size() < count) {
+        string word(length(rng), 'A');
+        for (char& c : word) {
+            c = static_cast<char>(letter(rng));
+        }
+        if (dictionary.count(word) == 0) {
+            negatives.push_back(arena.intern(word));
+        }
     }
 
-    vector<size_t> getHashes(const string& word) {
-        vector<size_t> hashes(numHashFuncs);
+    return negatives;
+}
 
-        int hash1 = hashF1(word);
-        int hash2 = hashF2(word);
+// Sweeps the filter over a grid of bit-vector sizes and hash-function counts,
+// checking every probe against the exact dictionary. Only tokens that are not
+// dictionary words are used as probes, so every hit is a false positive.
+void runFalsePositiveBenchmark(const Dafsa::Dafsa& dictionary, const SortedDictionary::EytzingerDictionary& members,
+                               const vector<string_view>& probes, const vector<size_t>& bitsGrid,
+                               const vector<size_t>& hashGrid, const string& hashName, const string& layout) {
+    vector<string> dictionaryKeys = dictionary.words();
+    vector<string_view> keys(dictionaryKeys.begin(), dictionaryKeys.end());
+    vector<string_view> negatives;
+    for (string_view word : probes) {
+        if (members.count(word) == 0) {
+            negatives.push_back(word);
+        }
+    }
+
+    if (negatives.empty()) {
+        cerr << "Error: No probe words fall outside the dictionary." << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    cout << "dictionary keys: " << dictionary.size() << ", negative probes: " << negatives.size() << endl;
+    cout << "bits\thashf\tbits/key\tmeasured_fpr\ttheoretical_fpr\tns/lookup" << endl;
+
+    for (size_t numberOfBits : bitsGrid) {
+        for (size_t numberOfHashFunctions : hashGrid) {
+            unique_ptr<AnyBloomFilter> bf = makeBloomFilter(numberOfBits, numberOfHashFunctions, hashName, layout);
+            bf->insertAll(keys);
+
+            vector<uint8_t> hits(negatives.size());
+            auto start = chrono::steady_clock::now();
+            size_t falsePositives = bf->searchAll(negatives, 0, negatives.size(), hits);
+            auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+
+            cout << bf->get_num_bits() << "\t" << numberOfHashFunctions << "\t"
+                 << static_cast<double>(bf->get_num_bits()) / dictionary.size() << "\t"
+                 << static_cast<double>(falsePositives) / negatives.size() << "\t"
+                 << bf->false_positive_probability() << "\t"
+                 << static_cast<double>(elapsed.count()) / negatives.size() << endl;
+        }
+    }
+}
+
+// Times membership lookups for the same probes in every dictionary structure
+// the tools use. The Bloom filter's hit count includes its false positives;
+// the others must all agree. Probes are copied into std::strings first, so
+// the standard containers are timed without building a key per lookup. The
+// filter is timed through its batch call, as the counting loops use it.
+void runDictionaryBenchmark(const vector<string_view>& dictionaryWords, const Dafsa::Dafsa& dictionary,
+                            const SortedDictionary::EytzingerDictionary& members, AnyBloomFilter& bf,
+                            const vector<string_view>& probeWords) {
+    vector<string> keys(dictionaryWords.begin(), dictionaryWords.end());
+    set<string> ordered(keys.begin(), keys.end());
+    unordered_set<string> hashed(keys.begin(), keys.end());
+    vector<string> probes(probeWords.begin(), probeWords.end());
+    size_t rounds = max<size_t>(1, 2000000 / max<size_t>(probes.size(), 1));
+
+    // countHits() runs one round over the probes and returns its hit count.
+    auto time = [&](const string& name, auto countHits) {
+        size_t hits = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; round++) {
+            hits += countHits();
+        }
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        cout << name << "\t" << hits / rounds << "\t"
+             << static_cast<double>(elapsed.count()) / (rounds * probes.size()) << endl;
+    };
+    auto eachProbe = [&](auto contains) {
+        return [&, contains]() {
+            size_t hits = 0;
+            for (const auto& word : probes) {
+                hits += contains(word) ? 1 : 0;
+            }
+            return hits;
+        };
+    };
+    vector<uint8_t> bloomHits(probeWords.size());
+
+    cout << "dictionary keys: " << dictionary.size() << ", probes: " << probes.size() << " x " << rounds << endl;
+    cout << "structure\thits\tns/lookup" << endl;
+    time("std::set", eachProbe([&](const string& word) { return ordered.count(word) != 0; }));
+    time("std::unordered_set", eachProbe([&](const string& word) { return hashed.count(word) != 0; }));
+    time("eytzinger", eachProbe([&](const string& word) { return members.contains(word); }));
+    time("dafsa", eachProbe([&](const string& word) { return dictionary.contains(word); }));
+    time("bloom", [&]() { return bf.searchAll(probeWords, 0, probeWords.size(), bloomHits); });
+}
 
-        for (size_t i = 0; i < numHashFuncs; i++) {
-            hashes[i] = (hash1 + i * hash2) % numBits;
+// Draws count tokens from a vocabulary of random words whose frequencies
+// follow Zipf's law (s = 1), the shape of word counts in natural text. Words
+// are 3 to 20 letters, so keys both fit inline and spill to the map's arena.
+// The words are kept in arena.
+vector<string_view> makeZipfTokens(size_t count, size_t vocabularySize, WordArena::Arena& arena) {
+    mt19937_64 rng(42);
+    uniform_int_distribution<int> letter('A', 'Z');
+    uniform_int_distribution<size_t> length(3, 20);
+    vector<string_view> vocabulary;
+    vector<double> cumulative;
+    double total = 0.0;
+    for (size_t rank = 1; rank <= vocabularySize; rank++) {
+        string word(length(rng), 'A');
+        for (char& c : word) {
+            c = static_cast<char>(letter(rng));
         }
+        vocabulary.push_back(arena.intern(word));
+        total += 1.0 / rank;
+        cumulative.push_back(total);
+    }
+
+    uniform_real_distribution<double> draw(0.0, total);
+    vector<string_view> tokens;
+    tokens.reserve(count);
+    for (size_t i = 0; i < count && !vocabulary.empty(); i++) {
+        size_t rank = lower_bound(cumulative.begin(), cumulative.end(), draw(rng)) - cumulative.begin();
+        tokens.push_back(vocabulary[min(rank, vocabulary.size() - 1)]);
+    }
+    return tokens;
+}
 
-        return hashes;
+// Times counting each corpus into std::unordered_map keyed by string and by
+// string_view, and into FlatWordMap. Every round starts from an empty map, so
+// growth is part of the cost. The string-keyed map is fed std::strings, as the
+// counting loops used to be, so it never builds a key just to look one up.
+void runMapBenchmark(const vector<pair<string, vector<string_view>>>& corpora) {
+    cout << "corpus\tstructure\tdistinct\tns/token" << endl;
+    for (const auto& [corpusName, tokens] : corpora) {
+        if (tokens.empty()) {
+            continue;
+        }
+        vector<string> ownedTokens(tokens.begin(), tokens.end());
+        size_t rounds = max<size_t>(1, 4000000 / tokens.size());
+
+        auto time = [&](const string& name, auto count) {
+            size_t distinct = 0;
+            auto start = chrono::steady_clock::now();
+            for (size_t round = 0; round < rounds; round++) {
+                distinct = count();
+            }
+            auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+            cout << corpusName << "\t" << name << "\t" << distinct << "\t"
+                 << static_cast<double>(elapsed.count()) / (rounds * tokens.size()) << endl;
+        };
+
+        time("unordered_map<string>", [&]() {
+            unordered_map<string, int> counts;
+            for (const auto& word : ownedTokens) {
+                counts[word]++;
+            }
+            return counts.size();
+        });
+        time("unordered_map<string_view>", [&]() {
+            unordered_map<string_view, int> counts;
+            for (string_view word : tokens) {
+                counts[word]++;
+            }
+            return counts.size();
+        });
+        time("flat_word_map", [&]() {
+            FlatMap::FlatWordMap<int> counts;
+            for (string_view word : tokens) {
+                counts[word]++;
+            }
+            return counts.size();
+        });
     }
+}
+
+// Flat and allocation-free per word; its slot arrays go on huge pages once they
+// are large enough.
+using WordCountMap = FlatMap::FlatWordMap<int>;
+
+struct GatedCountStats {
+    size_t tokens = 0;
+    size_t bloomRejected = 0;
+    size_t falsePositives = 0;
 };
 
-template <typename Container>
-void loadContainer(const string& path, size_t minimumWordLength, Container& data) {
-    string line;
-    ifstream inputFile;
+// Counts only dictionary words. The Bloom filter rejects most non-dictionary
+// tokens with a bit test; the few that pass are looked up in the dictionary's
+// perfect hash, whose fingerprint drops false positives, and counted in a
+// flat array indexed by word id.
+vector<int> countDictionaryWords(AnyBloomFilter& bf, const PerfectHash::MinimalPerfectHash& dictionary,
+                                 const vector<string_view>& tokens, GatedCountStats& stats) {
+    vector<int> counts(dictionary.size(), 0);
+    PerfectHash::View index = dictionary.view();
+    vector<uint8_t> hits(tokens.size());
+    bf.searchAll(tokens, 0, tokens.size(), hits);
+
+    for (size_t i = 0; i < tokens.size(); i++) {
+        string_view word = tokens[i];
+        stats.tokens++;
+        if (!hits[i]) {
+            stats.bloomRejected++;
+            continue;
+        }
+        uint32_t id = index.lookup(word.data(), static_cast<uint32_t>(word.size()));
+        if (id == PerfectHash::notFound) {
+            stats.falsePositives++;
+        } else {
+            counts[id]++;
+        }
+    }
 
-    inputFile.open(path);
+    return counts;
+}
 
-    if (inputFile.is_open()) {
-        while (getline(inputFile, line)) {
-            transform(line.begin(), line.end(), line.begin(), ::toupper);
-            if (line.length() >= minimumWordLength && line.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ") == string::npos) {
-                data.insert(data.end(), line);
-            }
+// Copies the built filter once per NUMA node. Each copy is made by a thread
+// pinned to that node, so first-touch places the replica in local memory; a
+// copy whose thread could not be pinned may not be, and is reported.
+vector<unique_ptr<AnyBloomFilter>> replicatePerNode(const AnyBloomFilter& bf, const vector<Numa::Node>& nodes) {
+    vector<unique_ptr<AnyBloomFilter>> replicas(nodes.size());
+    vector<uint8_t> pinned(nodes.size());
+    vector<thread> threads;
+
+    for (size_t n = 0; n < nodes.size(); n++) {
+        threads.emplace_back([&, n]() {
+            pinned[n] = Numa::pinToCpus(nodes[n].cpus);
+            replicas[n] = bf.clone();
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (size_t n = 0; n < nodes.size(); n++) {
+        if (!pinned[n]) {
+            cerr << "Warning: could not pin to NUMA node " << nodes[n].id << "; its replica may be remote." << endl;
         }
-    } else {
-        cerr << "Error: Could not open file '" << path << "'." << endl;
-        exit(EXIT_FAILURE);
     }
 
-    inputFile.close();
+    return replicas;
+}
+
+// Runs one query thread per CPU, pinned to its node and probing that node's
+// replica. With a dictionary the hits are verified as in countDictionaryWords.
+WordCountMap countWithReplicas(const vector<unique_ptr<AnyBloomFilter>>& replicas, const vector<Numa::Node>& nodes,
+                               const PerfectHash::MinimalPerfectHash* dictionary, const vector<string_view>& tokens) {
+    vector<pair<size_t, int>> workers;
+    for (size_t n = 0; n < nodes.size(); n++) {
+        for (int cpu : nodes[n].cpus) {
+            workers.emplace_back(n, cpu);
+        }
+    }
+
+    vector<WordCountMap> partialCounts(workers.size());
+    vector<uint8_t> pinned(workers.size());
+    vector<uint8_t> hits(tokens.size());
+    vector<thread> threads;
+    size_t sliceSize = (tokens.size() + workers.size() - 1) / workers.size();
+
+    for (size_t w = 0; w < workers.size(); w++) {
+        threads.emplace_back([&, w]() {
+            pinned[w] = Numa::pinToCpus({workers[w].second});
+            AnyBloomFilter& replica = *replicas[workers[w].first];
+            size_t begin = min(tokens.size(), w * sliceSize);
+            size_t end = min(tokens.size(), begin + sliceSize);
+            replica.searchAll(tokens, begin, end, hits);
+
+            for (size_t i = begin; i < end; i++) {
+                string_view word = tokens[i];
+                if (hits[i] &&
+                    (dictionary == nullptr || dictionary->lookup(word) != PerfectHash::notFound)) {
+                    partialCounts[w][word]++;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    size_t unpinned = count(pinned.begin(), pinned.end(), 0);
+    if (unpinned > 0) {
+        cerr << "Warning: " << unpinned << " of " << workers.size()
+             << " query threads could not be pinned and may have probed a remote replica." << endl;
+    }
+
+    WordCountMap wordCount;
+    for (const auto& partial : partialCounts) {
+        partial.forEach([&](string_view word, int count) { wordCount[word] += count; });
+    }
+
+    return wordCount;
 }
 
 }  // namespace WordCountBloomFilter
@@ -127,6 +593,20 @@ int main(int argc, char **argv) {
   string dictionaryPath = "wordlist.txt";
   string hamletPath = "hamlet_test.txt";
   size_t wordSize = 1;
+  bool fprBenchmark = false;
+  bool dictionaryBenchmark = false;
+  bool mapBenchmark = false;
+  size_t zipfTokens = 1000000;
+  vector<size_t> benchBits;
+  vector<size_t> benchHashFunctions;
+  size_t syntheticNegatives = 0;
+  bool gated = false;
+  string hashName = "md5sha256";
+  string layout = "flat";
+  bool numaReplicas = false;
+  string engineName = "auto";
+  string perfectHashPath;
+  vector<string> prefixes;
 
   CLI::App app{"Bloom Filter Implementation"};
   app.option_defaults()->always_capture_default(true);
@@ -149,31 +629,167 @@ int main(int argc, char **argv) {
 
   app.add_option("--wordSize", wordSize, "Minimum word size (default = 1)");
 
+  app.add_flag("--dict-bench", dictionaryBenchmark,
+               "Time exact dictionary lookups against std::set, std::unordered_set and the Bloom filter");
+
+  app.add_flag("--map-bench", mapBenchmark,
+               "Time word counting in std::unordered_map against the flat map on hamlet and a Zipf corpus");
+
+  app.add_option("--zipf-tokens", zipfTokens, "Tokens in the Zipf corpus for --map-bench (default = 1000000)");
+
+  app.add_flag("--fpr-bench", fprBenchmark,
+               "Measure the false-positive rate against the exact dictionary");
+
+  app.add_option("--bench-bits", benchBits,
+                 "Bit-vector sizes to sweep in --fpr-bench (default = --bits)")
+      ->check(CLI::PositiveNumber);
+
+  app.add_option("--bench-hashf", benchHashFunctions,
+                 "Hash-function counts to sweep in --fpr-bench (default = --hashf)")
+      ->check(CLI::PositiveNumber);
+
+  app.add_option("--synthetic", syntheticNegatives,
+                 "Probe with this many random non-dictionary words instead of hamlet");
+
+  app.add_option("--hash", hashName, "Hash policy: md5sha256 or fnv1a (default = md5sha256)")
+      ->check(CLI::IsMember({"md5sha256", "fnv1a"}));
+
+  app.add_option("--layout", layout, "Bit layout: flat or blocked (default = flat)")
+      ->check(CLI::IsMember({"flat", "blocked"}));
+
+  app.add_option("--engine", engineName, "Counting engine: auto, serial, threads or sketch (default = auto)")
+      ->check(CLI::IsMember({"auto", "serial", "threads", "sketch"}));
+
+  app.add_flag("--numa", numaReplicas,
+               "Replicate the filter per NUMA node and query with node-pinned threads");
+
+  app.add_flag("--gated", gated,
+               "Count only dictionary words, verifying Bloom hits against the dictionary");
+
+  app.add_option("--mphf", perfectHashPath,
+                 "Load the dictionary's perfect hash for --gated from this file, or build and save it there");
+
+  app.add_option("--prefix", prefixes,
+                 "After counting, list the dictionary words starting with each prefix and their total count");
+
   CLI11_PARSE(app, argc, argv);
 
-  set<string> dictionary;
-  set<string> hamletSet;
-  vector<string> hamletVector;
-  WordCountBloomFilter::loadContainer(dictionaryPath, wordSize, dictionary);
-  WordCountBloomFilter::loadContainer(hamletPath, wordSize, hamletSet);
-  WordCountBloomFilter::loadContainer(hamletPath, wordSize, hamletVector);
+  WordLoader::LoadedWords dictionaryFile = WordLoader::loadWords(dictionaryPath, wordSize, WordLoader::Tokens);
+  const vector<string_view> &dictionaryWords = dictionaryFile.tokens;
+  Dafsa::Dafsa dictionary(dictionaryWords);
+  SortedDictionary::EytzingerDictionary members(dictionaryWords);
+  cerr << "dictionary: " << dictionary.size() << " words in " << dictionary.numNodes() << " automaton nodes, "
+       << dictionary.memoryBytes() / 1024 << " KB" << endl;
+  WordLoader::LoadedWords hamlet = WordLoader::loadWords(hamletPath, wordSize, WordLoader::Tokens);
+  const vector<string_view> &hamletVector = hamlet.tokens;
+
+  if (mapBenchmark) {
+    WordArena::Arena zipfArena;
+    WordCountBloomFilter::runMapBenchmark(
+        {{"hamlet", hamletVector},
+         {"zipf", WordCountBloomFilter::makeZipfTokens(zipfTokens, max<size_t>(zipfTokens / 10, 1), zipfArena)}});
+    return 0;
+  }
+
+  if (fprBenchmark) {
+    if (benchBits.empty()) {
+      benchBits.push_back(numberOfBits);
+    }
+    if (benchHashFunctions.empty()) {
+      benchHashFunctions.push_back(numberOfHashFunctions);
+    }
+    WordArena::Arena negativesArena;
+    vector<string_view> probes = syntheticNegatives > 0
+        ? WordCountBloomFilter::makeSyntheticNegatives(members, syntheticNegatives, wordSize, negativesArena)
+        : hamletVector;
+    WordCountBloomFilter::runFalsePositiveBenchmark(dictionary, members, probes, benchBits, benchHashFunctions, hashName, layout);
+    return 0;
+  }
+
+  unique_ptr<WordCountBloomFilter::AnyBloomFilter> bf =
+      WordCountBloomFilter::makeBloomFilter(numberOfBits, numberOfHashFunctions, hashName, layout);
 
-  WordCountBloomFilter::BloomFilter bf(numberOfBits, numberOfHashFunctions);
+  vector<string> dictionaryKeys = dictionary.words();
+  bf->insertAll(vector<string_view>(dictionaryKeys.begin(), dictionaryKeys.end()));
 
-  for (const auto &word : dictionary) {
-    bf.insert(word);
+  HugePages::report(cerr);
+
+  if (dictionaryBenchmark) {
+    WordCountBloomFilter::runDictionaryBenchmark(dictionaryWords, dictionary, members, *bf, hamletVector);
+    return 0;
   }
 
-  unordered_map<string, int> wordCount;
-  for (const auto &word : hamletVector) {
-    if (bf.search(word) != -1.0) {
-      wordCount[word]++;
+  vector<string> wordsById;
+  PerfectHash::MinimalPerfectHash dictionaryIndex;
+  if (gated) {
+    try {
+      dictionaryIndex = PerfectHash::loadOrBuild(dictionaryKeys, perfectHashPath, wordsById);
+    } catch (const std::runtime_error& e) {
+      cerr << "Error: " << e.what() << endl;
+      exit(EXIT_FAILURE);
     }
   }
 
-  for (const auto &[word, count] : wordCount) {
+  vector<pair<string, int>> wordCountPairs;
+  if (numaReplicas) {
+    vector<Numa::Node> nodes = Numa::discoverNodes();
+    auto replicas = WordCountBloomFilter::replicatePerNode(*bf, nodes);
+    cerr << "NUMA nodes: " << nodes.size() << endl;
+    auto wordCount =
+        WordCountBloomFilter::countWithReplicas(replicas, nodes, gated ? &dictionaryIndex : nullptr, hamletVector);
+    wordCountPairs = FlatMap::toPairs(wordCount);
+  } else if (gated) {
+    WordCountBloomFilter::GatedCountStats stats;
+    vector<int> counts = WordCountBloomFilter::countDictionaryWords(*bf, dictionaryIndex, hamletVector, stats);
+    cerr << "tokens: " << stats.tokens << ", bloom rejected: " << stats.bloomRejected
+         << ", false positives removed: " << stats.falsePositives << endl;
+    for (size_t id = 0; id < counts.size(); id++) {
+      if (counts[id] > 0) {
+        wordCountPairs.emplace_back(wordsById[id], counts[id]);
+      }
+    }
+  } else {
+    vector<uint8_t> isHit(hamletVector.size());
+    bf->searchAll(hamletVector, 0, hamletVector.size(), isHit);
+    vector<string_view> hits;
+    for (size_t i = 0; i < hamletVector.size(); i++) {
+      if (isHit[i]) {
+        hits.push_back(hamletVector[i]);
+      }
+    }
+
+    if (engineName == "auto") {
+      engineName = CountingEngines::chooseEngine(CountingEngines::profileTokens(hits, false));
+    }
+    unique_ptr<CountingEngines::CountingEngine> counter = CountingEngines::makeHostEngine(engineName);
+    cerr << "counting engine: " << counter->name() << endl;
+    counter->ingest(hits);
+    counter->finish();
+    wordCountPairs = counter->results();
+  }
+
+  for (const auto &[word, count] : wordCountPairs) {
     cout << word << " : " << count << endl;
   }
 
+  if (!prefixes.empty()) {
+    vector<uint64_t> countsById(dictionary.size(), 0);
+    for (const auto &[word, count] : wordCountPairs) {
+      uint32_t id = dictionary.index(word);
+      if (id != Dafsa::notFound) {
+        countsById[id] += count;
+      }
+    }
+    Dafsa::PrefixCounts prefixCounts(countsById);
+    for (const auto &prefix : prefixes) {
+      auto range = dictionary.prefixRange(prefix);
+      cout << "prefix " << prefix << " : " << range.second << " dictionary words, "
+           << prefixCounts.sum(range) << " occurrences" << endl;
+      dictionary.forEachWithPrefix(prefix, [&](const string &word, uint32_t id) {
+        cout << "  " << word << " : " << countsById[id] << endl;
+      });
+    }
+  }
+
   return 0;
 }
@@ -1,19 +1,23 @@
 #include "bloom.h"
+#include "device_tokens.h"
+#include "flat_word_map.h"
+#include "perfect_hash.h"
+#include "word_loader.h"
 // #include <CLI/CLI.hpp>
 #include "CLI11.hpp"
-#include <openssl/md5.h>
-#include <openssl/sha.h>
 #include <string.h>
 #include <unistd.h>
 #include <bitset>
 #include <limits>
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <set>
 #include <fstream>
 #include <algorithm> 
 #include <string>
+#include <string_view>
 #include <iterator>
 #include <cctype>
 
@@ -24,67 +28,176 @@ using namespace cl::sycl;
 
 namespace WordCountBloomFilter {
 
+// Hit-bitmap words handled by one work-item when compacting search results.
+constexpr size_t compactChunkWords = 64;
+
 class BloomFilter {
 public:
-    BloomFilter(size_t numberOfBits, size_t numberOfHashFunctions)
-        : numBits(numberOfBits)
+    BloomFilter(queue& q, size_t numberOfBits, size_t numberOfHashFunctions)
+        : q(q)
+        , numBits(numberOfBits)
         , numHashFuncs(numberOfHashFunctions)
+        , numWords((numberOfBits + 31) / 32)
         , numInserts(0)
         , collisions(0) {
-            data = make_unique<bitset<1000000>>(numBits);
+            data = malloc_device<uint32_t>(numWords, q);
+            q.memset(data, 0, numWords * sizeof(uint32_t)).wait();
+    }
+
+    ~BloomFilter() {
+        sycl::free(data, q);
     }
 
-    void insert(const string& element) {
-        vector<size_t> hashes = getHashes(element);
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
 
-        queue myQueue;
-        buffer<size_t, 1> hashes_buffer(hashes.data(), range<1>(hashes.size()));
-        vector<bool> data_vector(data->size());
-        for (size_t i = 0; i < data->size(); i++) {
-            data_vector[i] = (*data)[i];
+    // Hashes and inserts the whole batch in one kernel; bits are set with
+    // fetch_or on the resident 32-bit words, so the filter never leaves the device.
+    void insert(const vector<string_view>& elements) {
+        if (elements.empty()) {
+            return;
         }
-        buffer<bool, 1> data_buffer(data_vector.data(), range<1>(data_vector.size()));
-        myQueue.submit([&](handler& cgh) {
-            auto hashes_acc = hashes_buffer.get_access<access::mode::read>(cgh);
-            auto data_acc = data_buffer.get_access<access::mode::read_write>(cgh);
-            cgh.parallel_for<class insert_kernel>(range<1>(hashes.size()), [=](id<1> idx) {
-                size_t hash = hashes_acc[idx];
-                if (data_acc[hash]) {
-                    atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> collisions_atomic(collisions);
-                    collisions_atomic++;
+
+        FlatTokens tokens = flattenTokens(elements);
+        DeviceTokens deviceTokens = upload(tokens);
+        unsigned int* collisionsDevice = malloc_device<unsigned int>(1, q);
+        q.memset(collisionsDevice, 0, sizeof(unsigned int)).wait();
+
+        uint32_t* bits = data;
+        uint64_t m = numBits;
+        uint64_t k = numHashFuncs;
+        const char* bytes = deviceTokens.bytes;
+        const uint32_t* offsets = deviceTokens.offsets;
+
+        q.parallel_for<class insert_kernel>(range<1>(tokens.size()), [=](id<1> idx) {
+            uint32_t begin = offsets[idx];
+            uint64_t hash = fnv1a64(bytes + begin, offsets[idx + 1] - begin);
+            unsigned int localCollisions = 0;
+            for (uint64_t i = 0; i < k; i++) {
+                uint64_t bit = bloomProbe(hash, i, m);
+                uint32_t mask = 1u << (bit % 32);
+                sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> word(bits[bit / 32]);
+                if (word.fetch_or(mask) & mask) {
+                    localCollisions++;
                 }
-                data_acc[hash] = true;
-            });
-        });
-        myQueue.wait_and_throw();
-        std::copy(data_buffer.get_host_access().begin(), data_buffer.get_host_access().end(), data->begin());
-        numInserts++;
+            }
+            if (localCollisions > 0) {
+                sycl::atomic_ref<unsigned int, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> collisions_atomic(*collisionsDevice);
+                collisions_atomic.fetch_add(localCollisions);
+            }
+        }).wait_and_throw();
+
+        unsigned int batchCollisions = 0;
+        q.memcpy(&batchCollisions, collisionsDevice, sizeof(unsigned int)).wait();
+        sycl::free(collisionsDevice, q);
+        release(deviceTokens);
+
+        collisions += batchCollisions;
+        numInserts += elements.size();
     }
 
-    double search(const string& element) {
-        vector<size_t> hashes = getHashes(element);
+    void insert(string_view element) {
+        insert(vector<string_view>{element});
+    }
 
-        bool all_found = true;
-        queue myQueue;
-        buffer<size_t, 1> hashes_buffer(hashes.data(), range<1>(hashes.size()));
-        vector<bool> data_vector(data->size());
-        for (size_t i = 0; i < data->size(); i++) {
-            data_vector[i] = (*data)[i];
+    // Tests every token against the resident filter in a single kernel. Bit i of
+    // hitBitmap is set when token i may be in the filter. The bitmap is then
+    // compacted on the device: each work-item counts the hits in a chunk of
+    // bitmap words, an exclusive scan over those counts gives every chunk its
+    // first output slot, and a scatter pass writes the chunk's hits in order.
+    // hitIndices therefore comes back dense and ascending without a host sort.
+    void search(const vector<string_view>& elements, vector<uint32_t>& hitBitmap, vector<uint32_t>& hitIndices) {
+        size_t bitmapWords = (elements.size() + 31) / 32;
+        hitBitmap.assign(bitmapWords, 0);
+        hitIndices.clear();
+        if (elements.empty()) {
+            return;
         }
-        buffer<bool, 1> data_buffer(data_vector.data(), range<1>(data_vector.size()));
-        myQueue.submit([&](handler& cgh) {
-            auto hashes_acc = hashes_buffer.get_access<access::mode::read>(cgh);
-            auto data_acc = data_buffer.get_access<access::mode::read>(cgh);
-            cgh.parallel_for<class search_kernel>(range<1>(hashes.size()), [=](id<1> idx) mutable {
-            size_t hash = hashes_acc[idx];
-                if (!data_acc[hash]) {
-                    all_found = false;
+
+        FlatTokens tokens = flattenTokens(elements);
+        DeviceTokens deviceTokens = upload(tokens);
+        uint32_t* bitmapDevice = malloc_device<uint32_t>(bitmapWords, q);
+        uint32_t* indicesDevice = malloc_device<uint32_t>(tokens.size(), q);
+        size_t numChunks = (bitmapWords + compactChunkWords - 1) / compactChunkWords;
+        uint32_t* chunkOffsetsDevice = malloc_device<uint32_t>(numChunks, q);
+        uint32_t* hitCountDevice = malloc_device<uint32_t>(1, q);
+        q.memset(bitmapDevice, 0, bitmapWords * sizeof(uint32_t)).wait();
+
+        const uint32_t* bits = data;
+        uint64_t m = numBits;
+        uint64_t k = numHashFuncs;
+        const char* bytes = deviceTokens.bytes;
+        const uint32_t* offsets = deviceTokens.offsets;
+
+        q.parallel_for<class search_kernel>(range<1>(tokens.size()), [=](id<1> idx) {
+            uint32_t begin = offsets[idx];
+            uint64_t hash = fnv1a64(bytes + begin, offsets[idx + 1] - begin);
+            for (uint64_t i = 0; i < k; i++) {
+                uint64_t bit = bloomProbe(hash, i, m);
+                if (!(bits[bit / 32] & (1u << (bit % 32)))) {
+                    return;
+                }
+            }
+
+            uint32_t token = static_cast<uint32_t>(idx[0]);
+            sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> bitmapWord(bitmapDevice[token / 32]);
+            bitmapWord.fetch_or(1u << (token % 32));
+        }).wait_and_throw();
+
+        q.parallel_for<class hit_count_kernel>(range<1>(numChunks), [=](id<1> c) {
+            size_t begin = c * compactChunkWords;
+            size_t end = std::min(bitmapWords, begin + compactChunkWords);
+            uint32_t hits = 0;
+            for (size_t w = begin; w < end; w++) {
+                hits += sycl::popcount(bitmapDevice[w]);
+            }
+            chunkOffsetsDevice[c] = hits;
+        }).wait_and_throw();
+
+        // One chunk per 2048 tokens, so a serial scan over the chunk counts is short.
+        q.single_task<class hit_scan_kernel>([=]() {
+            uint32_t running = 0;
+            for (size_t c = 0; c < numChunks; c++) {
+                uint32_t hits = chunkOffsetsDevice[c];
+                chunkOffsetsDevice[c] = running;
+                running += hits;
+            }
+            *hitCountDevice = running;
+        }).wait_and_throw();
+
+        q.parallel_for<class hit_scatter_kernel>(range<1>(numChunks), [=](id<1> c) {
+            size_t begin = c * compactChunkWords;
+            size_t end = std::min(bitmapWords, begin + compactChunkWords);
+            uint32_t next = chunkOffsetsDevice[c];
+            for (size_t w = begin; w < end; w++) {
+                for (uint32_t hits = bitmapDevice[w]; hits != 0; hits &= hits - 1) {
+                    indicesDevice[next++] = static_cast<uint32_t>(w * 32 + sycl::ctz(hits));
                 }
-            });
-        });
-        myQueue.wait_and_throw();
+            }
+        }).wait_and_throw();
+
+        uint32_t numHits = 0;
+        q.memcpy(&numHits, hitCountDevice, sizeof(uint32_t)).wait();
+        hitIndices.resize(numHits);
+        q.memcpy(hitBitmap.data(), bitmapDevice, bitmapWords * sizeof(uint32_t));
+        if (numHits > 0) {
+            q.memcpy(hitIndices.data(), indicesDevice, numHits * sizeof(uint32_t));
+        }
+        q.wait();
 
-        if (!all_found) {
+        sycl::free(bitmapDevice, q);
+        sycl::free(indicesDevice, q);
+        sycl::free(chunkOffsetsDevice, q);
+        sycl::free(hitCountDevice, q);
+        release(deviceTokens);
+    }
+
+    double search(string_view element) {
+        vector<uint32_t> hitBitmap;
+        vector<uint32_t> hitIndices;
+        search(vector<string_view>{element}, hitBitmap, hitIndices);
+
+        if (hitIndices.empty()) {
             return -1.0;
         }
 
@@ -96,61 +209,92 @@ public:
     int get_collisions() { return collisions; }
 
 private:
+    struct DeviceTokens {
+        char* bytes;
+        uint32_t* offsets;
+    };
+
+    queue& q;
     size_t numBits;
     size_t numHashFuncs;
-    unique_ptr<bitset<1000000>> data;
-    int numInserts;
+    size_t numWords;
+    uint32_t* data;
+    size_t numInserts;
     int collisions;
 
-    int hashF1(const string& word) {
-        unsigned char md[MD5_DIGEST_LENGTH];
-        MD5(reinterpret_cast<const unsigned char*>(word.c_str()), word.size(), md);
-        hash<string> strHash;
-        string str_md(reinterpret_cast<const char*>(md), MD5_DIGEST_LENGTH);
-        return strHash(str_md.substr(0, 6)) % numBits;
-    }
-
-    int hashF2(const string& word) {
-        unsigned char md[SHA256_DIGEST_LENGTH];
-        SHA256(reinterpret_cast<const unsigned char*>(word.c_str()), word.size(), md);
-        hash<string> strHash;
-        string str_md(reinterpret_cast<const char*>(md), SHA256_DIGEST_LENGTH);
-        return strHash(str_md.substr(0, 6)) % numBits;
-    }
-
-    vector<size_t> getHashes(const string& word) {
-        vector<size_t> hashes(numHashFuncs);
-
-        int hash1 = hashF1(word);
-        int hash2 = hashF2(word);
-
-        for (size_t i = 0; i < numHashFuncs; i++) {
-            hashes[i] = (hash1 + i * hash2) % numBits;
+    DeviceTokens upload(const FlatTokens& tokens) {
+        DeviceTokens deviceTokens;
+        deviceTokens.bytes = malloc_device<char>(std::max<size_t>(tokens.bytes.size(), 1), q);
+        deviceTokens.offsets = malloc_device<uint32_t>(tokens.offsets.size(), q);
+        if (!tokens.bytes.empty()) {
+            q.memcpy(deviceTokens.bytes, tokens.bytes.data(), tokens.bytes.size());
         }
+        q.memcpy(deviceTokens.offsets, tokens.offsets.data(), tokens.offsets.size() * sizeof(uint32_t));
+        q.wait();
+        return deviceTokens;
+    }
 
-        return hashes;
+    void release(DeviceTokens& deviceTokens) {
+        sycl::free(deviceTokens.bytes, q);
+        sycl::free(deviceTokens.offsets, q);
     }
 };
 
-template <typename Container>
-void loadContainer(const string& path, size_t minimumWordLength, Container& data) {
-    string line;
-    ifstream inputFile;
-
-    inputFile.open(path);
+// Counts the Bloom hits that are dictionary words, entirely on the device. The
+// perfect hash's arrays are copied to device memory, each hit token is looked
+// up in the kernel, and members increment a flat counts[id] array; tokens the
+// fingerprint rejects are Bloom false positives and are dropped.
+vector<uint32_t> countDictionaryHits(queue& q, const PerfectHash::MinimalPerfectHash& dictionary,
+                                     const vector<string_view>& tokens, const vector<uint32_t>& hitIndices) {
+    vector<uint32_t> counts(dictionary.size(), 0);
+    if (hitIndices.empty() || dictionary.size() == 0) {
+        return counts;
+    }
 
-    if (inputFile.is_open()) {
-        while (getline(inputFile, line)) {
-            transform(line.begin(), line.end(), line.begin(), ::toupper);
-            if (line.length() >= minimumWordLength && line.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ") == string::npos) {
-                data.insert(data.end(), line);
-            }
-        }
-        inputFile.close();
-    } else {
-        cerr << "Error: Could not open file '" << path << "'." << endl;
-        exit(EXIT_FAILURE);
+    vector<string_view> hits;
+    hits.reserve(hitIndices.size());
+    for (uint32_t index : hitIndices) {
+        hits.push_back(tokens[index]);
     }
+    FlatTokens flat = flattenTokens(hits);
+
+    const auto& bitArray = dictionary.bitArray();
+    const auto& rankArray = dictionary.rankArray();
+    const auto& fingerprintArray = dictionary.fingerprintArray();
+    uint64_t* bitsDevice = malloc_device<uint64_t>(bitArray.size(), q);
+    uint32_t* ranksDevice = malloc_device<uint32_t>(rankArray.size(), q);
+    uint32_t* fingerprintsDevice = malloc_device<uint32_t>(fingerprintArray.size(), q);
+    char* bytesDevice = malloc_device<char>(std::max<size_t>(flat.bytes.size(), 1), q);
+    uint32_t* offsetsDevice = malloc_device<uint32_t>(flat.offsets.size(), q);
+    uint32_t* countsDevice = malloc_device<uint32_t>(counts.size(), q);
+    q.memcpy(bitsDevice, bitArray.data(), bitArray.size() * sizeof(uint64_t));
+    q.memcpy(ranksDevice, rankArray.data(), rankArray.size() * sizeof(uint32_t));
+    q.memcpy(fingerprintsDevice, fingerprintArray.data(), fingerprintArray.size() * sizeof(uint32_t));
+    if (!flat.bytes.empty()) {
+        q.memcpy(bytesDevice, flat.bytes.data(), flat.bytes.size());
+    }
+    q.memcpy(offsetsDevice, flat.offsets.data(), flat.offsets.size() * sizeof(uint32_t));
+    q.memset(countsDevice, 0, counts.size() * sizeof(uint32_t));
+    q.wait();
+
+    PerfectHash::View index = dictionary.viewWith(bitsDevice, ranksDevice, fingerprintsDevice);
+    q.parallel_for<class dictionary_count_kernel>(range<1>(flat.size()), [=](id<1> idx) {
+        uint32_t begin = offsetsDevice[idx];
+        uint32_t id = index.lookup(bytesDevice + begin, offsetsDevice[idx + 1] - begin);
+        if (id != PerfectHash::notFound) {
+            sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> count(countsDevice[id]);
+            count.fetch_add(1);
+        }
+    }).wait_and_throw();
+
+    q.memcpy(counts.data(), countsDevice, counts.size() * sizeof(uint32_t)).wait();
+    sycl::free(bitsDevice, q);
+    sycl::free(ranksDevice, q);
+    sycl::free(fingerprintsDevice, q);
+    sycl::free(bytesDevice, q);
+    sycl::free(offsetsDevice, q);
+    sycl::free(countsDevice, q);
+    return counts;
 }
 
 }  // namespace WordCountBloomFilter
@@ -161,6 +305,8 @@ int main(int argc, char **argv) {
     string dictionaryPath = "wordlist.txt";
     string hamletPath = "hamlet_test.txt";
     size_t wordSize = 1;
+    bool gated = false;
+    string perfectHashPath;
 
     CLI::App app{"Bloom Filter Implementation"};
     app.option_defaults()->always_capture_default(true);
@@ -183,28 +329,53 @@ int main(int argc, char **argv) {
 
     app.add_option("--wordSize", wordSize, "Minimum word size (default = 1)");
 
-    CLI11_PARSE(app, argc, argv);
+    app.add_flag("--gated", gated,
+                 "Count only dictionary words, checking Bloom hits against a perfect hash on the device");
 
-    set<string> dictionary;
-    set<string> hamletSet;
-    vector<string> hamletVector;
-    WordCountBloomFilter::loadContainer(dictionaryPath, wordSize, dictionary);
-    WordCountBloomFilter::loadContainer(hamletPath, wordSize, hamletSet);
-    WordCountBloomFilter::loadContainer(hamletPath, wordSize, hamletVector);
+    app.add_option("--mphf", perfectHashPath,
+                   "Load the dictionary's perfect hash for --gated from this file, or build and save it there");
 
-    WordCountBloomFilter::BloomFilter bf(numberOfBits, numberOfHashFunctions);
-
-    unordered_map<string, int> wordCount;
+    CLI11_PARSE(app, argc, argv);
 
-    for (const auto &word : hamletVector) {
-        if (bf.search(word) != -1.0) {
-            wordCount[word]++;
+    WordLoader::LoadedWords dictionaryFile = WordLoader::loadWords(dictionaryPath, wordSize, WordLoader::Distinct);
+    const unordered_set<string_view>& dictionary = dictionaryFile.distinct;
+    WordLoader::LoadedWords hamlet = WordLoader::loadWords(hamletPath, wordSize, WordLoader::Tokens);
+    const vector<string_view>& hamletVector = hamlet.tokens;
+
+    queue q;
+    WordCountBloomFilter::BloomFilter bf(q, numberOfBits, numberOfHashFunctions);
+    bf.insert(vector<string_view>(dictionary.begin(), dictionary.end()));
+
+    FlatMap::FlatWordMap<int> wordCount;
+
+    vector<uint32_t> hitBitmap;
+    vector<uint32_t> hitIndices;
+    bf.search(hamletVector, hitBitmap, hitIndices);
+
+    if (gated) {
+        vector<string> wordsById;
+        PerfectHash::MinimalPerfectHash dictionaryIndex;
+        try {
+            dictionaryIndex = PerfectHash::loadOrBuild(dictionary, perfectHashPath, wordsById);
+        } catch (const std::runtime_error& e) {
+            cerr << "Error: " << e.what() << endl;
+            exit(EXIT_FAILURE);
+        }
+        vector<uint32_t> counts = WordCountBloomFilter::countDictionaryHits(q, dictionaryIndex, hamletVector, hitIndices);
+        for (size_t id = 0; id < counts.size(); id++) {
+            if (counts[id] > 0) {
+                wordCount[wordsById[id]] = counts[id];
+            }
+        }
+    } else {
+        for (uint32_t index : hitIndices) {
+            wordCount[hamletVector[index]]++;
         }
     }
 
-    for (const auto &[word, count] : wordCount) {
+    wordCount.forEach([](string_view word, int count) {
         cout << word << " : " << count << endl;
-    }
+    });
 
     return 0;
 }
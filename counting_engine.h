@@ -0,0 +1,286 @@
+#ifndef COUNTING_ENGINE_H
+#define COUNTING_ENGINE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "device_tokens.h"
+#include "flat_word_map.h"
+#include "numa.h"
+
+// Common interface for the word-counting back ends, so each tool's main feeds
+// tokens to whichever engine suits the input instead of its own loop.
+namespace CountingEngines {
+
+class CountingEngine {
+public:
+    virtual ~CountingEngine() = default;
+
+    virtual const char* name() const = 0;
+
+    // May be called any number of times before finish(). Engines copy what
+    // they keep, so tokens need not outlive the call.
+    virtual void ingest(const std::vector<std::string_view>& tokens) = 0;
+
+    // Engines that can read and tokenize a corpus themselves do so here and
+    // return true; the rest return false and expect ingest() instead.
+    virtual bool ingestFile(const std::string& path, size_t minimumWordLength) {
+        (void)path;
+        (void)minimumWordLength;
+        return false;
+    }
+
+    virtual void finish() = 0;
+
+    // Valid after finish(); in no particular order.
+    virtual std::vector<std::pair<std::string, int>> results() const = 0;
+};
+
+
+class SerialEngine : public CountingEngine {
+public:
+    const char* name() const override { return "serial"; }
+
+    void ingest(const std::vector<std::string_view>& tokens) override {
+        for (std::string_view word : tokens) {
+            wordCounts[word]++;
+        }
+    }
+
+    void finish() override {}
+
+    std::vector<std::pair<std::string, int>> results() const override {
+        return FlatMap::toPairs(wordCounts);
+    }
+
+private:
+    FlatMap::FlatWordMap<int> wordCounts;
+};
+
+
+// Pinned workers count slices of each batch into private maps that are already
+// split by owner (hash % threads). finish() merges in parallel: worker m
+// combines every worker's partition m, so no two threads touch the same key.
+// The owner comes from the same hash the maps use, so each token is hashed
+// once.
+class ThreadedEngine : public CountingEngine {
+public:
+    explicit ThreadedEngine(size_t numberOfThreads = Numa::usableCpus())
+        : numThreads(std::max<size_t>(numberOfThreads, 1))
+        , partials(numThreads)
+        , merged(numThreads) {
+        for (auto& partitions : partials) {
+            partitions.resize(numThreads);
+        }
+        for (const auto& node : Numa::discoverNodes()) {
+            cpus.insert(cpus.end(), node.cpus.begin(), node.cpus.end());
+        }
+    }
+
+    const char* name() const override { return "threads"; }
+
+    void ingest(const std::vector<std::string_view>& tokens) override {
+        runWorkers([&](size_t w) {
+            size_t begin = tokens.size() * w / numThreads;
+            size_t end = tokens.size() * (w + 1) / numThreads;
+            for (size_t i = begin; i < end; i++) {
+                uint64_t hash = FlatMap::hashWord(tokens[i]);
+                partials[w][ownerOf(hash)].findOrInsert(tokens[i], hash)++;
+            }
+        });
+    }
+
+    void finish() override {
+        runWorkers([&](size_t m) {
+            for (size_t w = 0; w < numThreads; w++) {
+                partials[w][m].forEach([&](std::string_view word, int count) { merged[m][word] += count; });
+                partials[w][m].clear();
+            }
+        });
+    }
+
+    std::vector<std::pair<std::string, int>> results() const override {
+        std::vector<std::pair<std::string, int>> wordCountPairs;
+        for (const auto& partition : merged) {
+            std::vector<std::pair<std::string, int>> partitionPairs = FlatMap::toPairs(partition);
+            wordCountPairs.insert(wordCountPairs.end(), partitionPairs.begin(), partitionPairs.end());
+        }
+        return wordCountPairs;
+    }
+
+private:
+    size_t numThreads;
+    std::vector<int> cpus;
+    std::vector<std::vector<FlatMap::FlatWordMap<int>>> partials;
+    std::vector<FlatMap::FlatWordMap<int>> merged;
+
+    // The high half of the hash; the maps index groups with the low half.
+    size_t ownerOf(uint64_t hash) const { return (hash >> 32) % numThreads; }
+
+    template <typename Work>
+    void runWorkers(Work work) {
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < numThreads; w++) {
+            workers.emplace_back([&, w]() {
+                // The maps are private to each worker, so an unpinned worker
+                // only loses cache locality, not correctness.
+                Numa::pinToCpus({cpus[w % cpus.size()]});
+                work(w);
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+
+// Fixed-memory approximate counting for inputs with too many distinct words to
+// hold exactly: a count-min sketch estimates every word, and only the heaviest
+// candidates are kept by name. Counts are upper bounds.
+class SketchEngine : public CountingEngine {
+public:
+    SketchEngine(size_t sketchWidth = 1 << 20, size_t sketchDepth = 4, size_t numberOfWordsKept = 1000)
+        : width(sketchWidth)
+        , depth(sketchDepth)
+        , topK(numberOfWordsKept)
+        , threshold(0)
+        , counters(sketchWidth * sketchDepth, 0) {
+    }
+
+    const char* name() const override { return "sketch"; }
+
+    void ingest(const std::vector<std::string_view>& tokens) override {
+        for (std::string_view word : tokens) {
+            uint64_t hash = fnv1a64(word.data(), static_cast<uint32_t>(word.size()));
+            uint32_t estimate = UINT32_MAX;
+            for (size_t row = 0; row < depth; row++) {
+                uint32_t& counter = counters[row * width + bloomProbe(hash, row, width)];
+                counter++;
+                estimate = std::min(estimate, counter);
+            }
+
+            uint64_t keyHash = FlatMap::mixHash(hash);
+            int* candidate = candidates.find(word, keyHash);
+            if (candidate != nullptr) {
+                *candidate = estimate;
+            } else if (estimate > threshold || candidates.size() < topK) {
+                candidates.findOrInsert(word, keyHash) = estimate;
+                if (candidates.size() > 2 * topK) {
+                    prune();
+                }
+            }
+        }
+    }
+
+    void finish() override {
+        prune();
+    }
+
+    std::vector<std::pair<std::string, int>> results() const override {
+        return FlatMap::toPairs(candidates);
+    }
+
+private:
+    size_t width;
+    size_t depth;
+    size_t topK;
+    uint32_t threshold;
+    std::vector<uint32_t> counters;
+    FlatMap::FlatWordMap<int> candidates;
+
+    // Keeps the topK heaviest candidates; later words must beat the lightest.
+    void prune() {
+        if (candidates.size() <= topK) {
+            return;
+        }
+        std::vector<std::pair<std::string, int>> kept = FlatMap::toPairs(candidates);
+        std::nth_element(kept.begin(), kept.begin() + topK - 1, kept.end(),
+                         [](const auto& a, const auto& b) { return a.second > b.second; });
+        kept.resize(topK);
+        threshold = kept.back().second;
+        candidates = FlatMap::FlatWordMap<int>(2 * topK);
+        for (const auto& [word, count] : kept) {
+            candidates[word] = count;
+        }
+    }
+};
+
+
+// What the auto-selector knows about an input before counting it.
+struct EngineProfile {
+    size_t inputBytes;
+    size_t estimatedDistinct;
+    bool deviceAvailable;
+};
+
+// Below this, thread or SYCL start-up costs more than counting serially.
+constexpr size_t smallInputBytes = 1 << 20;
+// From here on a device is worth its start-up and transfer costs.
+constexpr size_t deviceInputBytes = 64 << 20;
+// More distinct words than this would not fit comfortably in an exact table.
+constexpr size_t sketchDistinctWords = 50000000;
+
+inline std::string chooseEngine(const EngineProfile& profile) {
+    if (profile.inputBytes < smallInputBytes) {
+        return "serial";
+    }
+    if (profile.estimatedDistinct > sketchDistinctWords) {
+        return "sketch";
+    }
+    if (profile.inputBytes >= deviceInputBytes && profile.deviceAvailable) {
+        return "sycl";
+    }
+    return "threads";
+}
+
+// Extrapolates the distinct count of sampleTokens, taken from the first
+// sampleBytes of a totalBytes input, with Heaps' law (vocabulary ~ sqrt(size)).
+inline size_t estimateDistinct(const std::vector<std::string_view>& sampleTokens, size_t sampleBytes, size_t totalBytes) {
+    std::unordered_set<std::string_view> distinct(sampleTokens.begin(), sampleTokens.end());
+    if (sampleBytes == 0 || totalBytes <= sampleBytes) {
+        return distinct.size();
+    }
+    return static_cast<size_t>(distinct.size() * std::sqrt(static_cast<double>(totalBytes) / sampleBytes));
+}
+
+// Profile of tokens already in memory; the first 64k tokens serve as the sample.
+inline EngineProfile profileTokens(const std::vector<std::string_view>& tokens, bool deviceAvailable) {
+    constexpr size_t sampleSize = 1 << 16;
+    std::vector<std::string_view> sample(tokens.begin(), tokens.begin() + std::min(tokens.size(), sampleSize));
+    size_t sampleBytes = 0;
+    size_t totalBytes = 0;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        totalBytes += tokens[i].size() + 1;
+        if (i < sample.size()) {
+            sampleBytes += tokens[i].size() + 1;
+        }
+    }
+    return {totalBytes, estimateDistinct(sample, sampleBytes, totalBytes), deviceAvailable};
+}
+
+// The SYCL-free engines; returns nullptr for names it does not know (e.g. "sycl").
+inline std::unique_ptr<CountingEngine> makeHostEngine(const std::string& name) {
+    if (name == "serial") {
+        return std::make_unique<SerialEngine>();
+    }
+    if (name == "threads") {
+        return std::make_unique<ThreadedEngine>();
+    }
+    if (name == "sketch") {
+        return std::make_unique<SketchEngine>();
+    }
+    return nullptr;
+}
+
+}  // namespace CountingEngines
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef DAFSA_H
+#define DAFSA_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Minimized acyclic automaton (DAFSA) over a sorted word list: shared
+// prefixes and shared suffixes are each stored once. After construction the
+// automaton is flattened into a few arrays in breadth-first order, with each
+// node's outgoing edges contiguous and sorted by label, so a lookup walks
+// short runs of adjacent bytes instead of chasing tree pointers.
+//
+// Every node also records how many words pass through it. That makes a
+// word's lexicographic rank its id, and turns the words under a prefix into
+// one contiguous id range, so count-by-prefix is a difference of two prefix
+// sums.
+namespace Dafsa {
+
+constexpr uint32_t notFound = UINT32_MAX;
+
+class Dafsa {
+public:
+    Dafsa() { build({}); }
+
+    // Words may come in any order and with duplicates.
+    template <typename Container>
+    explicit Dafsa(const Container& words) {
+        std::vector<std::string_view> sorted(words.begin(), words.end());
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+        build(sorted);
+    }
+
+    size_t size() const { return numWords.empty() ? 0 : numWords[0]; }
+
+    size_t numNodes() const { return numWords.size(); }
+
+    size_t memoryBytes() const {
+        return firstEdge.size() * sizeof(uint32_t) + numWords.size() * sizeof(uint32_t) +
+               isFinal.size() * sizeof(uint8_t) + labels.size() * sizeof(char) + targets.size() * sizeof(uint32_t);
+    }
+
+    bool contains(std::string_view word) const { return index(word) != notFound; }
+
+    size_t count(std::string_view word) const { return contains(word) ? 1 : 0; }
+
+    // Lexicographic rank of word among the dictionary, or notFound.
+    uint32_t index(std::string_view word) const {
+        uint32_t rank = 0;
+        uint32_t node = walk(word, rank);
+        return node != notFound && isFinal[node] ? rank : notFound;
+    }
+
+    // The ids of the words starting with prefix: [first, first + count).
+    std::pair<uint32_t, uint32_t> prefixRange(const std::string& prefix) const {
+        uint32_t rank = 0;
+        uint32_t node = walk(prefix, rank);
+        return node == notFound ? std::make_pair(0u, 0u) : std::make_pair(rank, numWords[node]);
+    }
+
+    // Calls visit(word, id) for every word starting with prefix, in order.
+    void forEachWithPrefix(const std::string& prefix, const std::function<void(const std::string&, uint32_t)>& visit) const {
+        uint32_t rank = 0;
+        uint32_t node = walk(prefix, rank);
+        if (node != notFound) {
+            std::string word = prefix;
+            enumerate(node, word, rank, visit);
+        }
+    }
+
+    void forEach(const std::function<void(const std::string&, uint32_t)>& visit) const {
+        forEachWithPrefix("", visit);
+    }
+
+    std::vector<std::string> words() const {
+        std::vector<std::string> all;
+        all.reserve(size());
+        forEach([&](const std::string& word, uint32_t) { all.push_back(word); });
+        return all;
+    }
+
+private:
+    // Node n's edges are [firstEdge[n], firstEdge[n + 1]).
+    std::vector<uint32_t> firstEdge;
+    std::vector<uint32_t> numWords;
+    std::vector<uint8_t> isFinal;
+    std::vector<char> labels;
+    std::vector<uint32_t> targets;
+
+    // Follows text from the root, adding to rank the words that sort before
+    // it; returns the node reached or notFound.
+    uint32_t walk(std::string_view text, uint32_t& rank) const {
+        uint32_t node = 0;
+        for (char c : text) {
+            rank += isFinal[node];
+            uint32_t edge = firstEdge[node];
+            uint32_t end = firstEdge[node + 1];
+            while (edge < end && labels[edge] < c) {
+                rank += numWords[targets[edge]];
+                edge++;
+            }
+            if (edge == end || labels[edge] != c) {
+                return notFound;
+            }
+            node = targets[edge];
+        }
+        return node;
+    }
+
+    void enumerate(uint32_t node, std::string& word, uint32_t& rank,
+                   const std::function<void(const std::string&, uint32_t)>& visit) const {
+        if (isFinal[node]) {
+            visit(word, rank++);
+        }
+        for (uint32_t edge = firstEdge[node]; edge < firstEdge[node + 1]; edge++) {
+            word.push_back(labels[edge]);
+            enumerate(targets[edge], word, rank, visit);
+            word.pop_back();
+        }
+    }
+
+    struct BuildNode {
+        bool isFinal = false;
+        std::vector<std::pair<char, uint32_t>> edges;
+    };
+
+    // Daciuk et al.'s incremental construction for sorted input: the path of
+    // the previous word stays open, and once the next word diverges from it
+    // the abandoned suffix is merged with an equivalent registered node.
+    void build(const std::vector<std::string_view>& sortedWords) {
+        std::vector<BuildNode> nodes(1);
+        std::unordered_map<std::string, uint32_t> registry;
+        std::vector<uint32_t> openPath{0};
+        std::string_view previous;
+
+        auto signature = [&](uint32_t node) {
+            std::string key(1, nodes[node].isFinal ? '1' : '0');
+            for (const auto& [label, target] : nodes[node].edges) {
+                key.push_back(label);
+                key.append(reinterpret_cast<const char*>(&target), sizeof(target));
+            }
+            return key;
+        };
+        auto minimize = [&](size_t depth) {
+            while (openPath.size() > depth + 1) {
+                uint32_t child = openPath.back();
+                openPath.pop_back();
+                auto [registered, inserted] = registry.emplace(signature(child), child);
+                if (!inserted) {
+                    nodes[openPath.back()].edges.back().second = registered->second;
+                }
+            }
+        };
+
+        for (const auto& word : sortedWords) {
+            size_t common = 0;
+            while (common < word.size() && common < previous.size() && word[common] == previous[common]) {
+                common++;
+            }
+            minimize(common);
+            for (size_t i = common; i < word.size(); i++) {
+                nodes.emplace_back();
+                uint32_t child = static_cast<uint32_t>(nodes.size() - 1);
+                nodes[openPath.back()].edges.emplace_back(word[i], child);
+                openPath.push_back(child);
+            }
+            nodes[openPath.back()].isFinal = true;
+            previous = word;
+        }
+        minimize(0);
+
+        flatten(nodes);
+    }
+
+    // Renumbers the reachable nodes breadth-first into the flat arrays.
+    void flatten(const std::vector<BuildNode>& nodes) {
+        std::vector<uint32_t> newId(nodes.size(), notFound);
+        std::vector<uint32_t> order{0};
+        newId[0] = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            for (const auto& edge : nodes[order[i]].edges) {
+                if (newId[edge.second] == notFound) {
+                    newId[edge.second] = static_cast<uint32_t>(order.size());
+                    order.push_back(edge.second);
+                }
+            }
+        }
+
+        firstEdge.assign(1, 0);
+        isFinal.clear();
+        labels.clear();
+        targets.clear();
+        for (uint32_t old : order) {
+            isFinal.push_back(nodes[old].isFinal);
+            for (const auto& [label, target] : nodes[old].edges) {
+                labels.push_back(label);
+                targets.push_back(newId[target]);
+            }
+            firstEdge.push_back(static_cast<uint32_t>(labels.size()));
+        }
+
+        // Children can sit anywhere in breadth-first order, so count words
+        // bottom-up with an explicit post-order walk.
+        numWords.assign(order.size(), 0);
+        std::vector<uint8_t> done(order.size(), 0);
+        std::vector<std::pair<uint32_t, uint32_t>> stack{{0, firstEdge[0]}};
+        while (!stack.empty()) {
+            auto& [node, edge] = stack.back();
+            if (edge < firstEdge[node + 1]) {
+                uint32_t child = targets[edge++];
+                if (!done[child]) {
+                    stack.emplace_back(child, firstEdge[child]);
+                }
+                continue;
+            }
+            uint32_t total = isFinal[node];
+            for (uint32_t e = firstEdge[node]; e < firstEdge[node + 1]; e++) {
+                total += numWords[targets[e]];
+            }
+            numWords[node] = total;
+            done[node] = 1;
+            stack.pop_back();
+        }
+    }
+};
+
+// Running totals of per-word counts indexed by Dafsa id, so the occurrences
+// of every word under a prefix sum in O(1).
+class PrefixCounts {
+public:
+    template <typename Counts>
+    explicit PrefixCounts(const Counts& countsById) : totals(countsById.size() + 1, 0) {
+        for (size_t id = 0; id < countsById.size(); id++) {
+            totals[id + 1] = totals[id] + countsById[id];
+        }
+    }
+
+    uint64_t sum(std::pair<uint32_t, uint32_t> range) const {
+        return totals[range.first + range.second] - totals[range.first];
+    }
+
+private:
+    std::vector<uint64_t> totals;
+};
+
+}  // namespace Dafsa
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef DEVICE_TOKENS_H
+#define DEVICE_TOKENS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Tokens packed into one contiguous byte array so a whole batch can be copied
+// to a device in a single transfer. Token i is bytes [offsets[i], offsets[i + 1]).
+struct FlatTokens {
+    std::vector<char> bytes;
+    std::vector<uint32_t> offsets;
+
+    size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+};
+
+template <typename Container>
+FlatTokens flattenTokens(const Container& words) {
+    FlatTokens tokens;
+    size_t totalBytes = 0;
+    for (const auto& word : words) {
+        totalBytes += word.size();
+    }
+
+    tokens.bytes.reserve(totalBytes);
+    tokens.offsets.reserve(words.size() + 1);
+    tokens.offsets.push_back(0);
+    for (const auto& word : words) {
+        tokens.bytes.insert(tokens.bytes.end(), word.begin(), word.end());
+        tokens.offsets.push_back(static_cast<uint32_t>(tokens.bytes.size()));
+    }
+
+    return tokens;
+}
+
+// FNV-1a over raw bytes. Plain integer code, so it runs unchanged inside kernels.
+inline uint64_t fnv1a64(const char* str, uint32_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(str[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Kirsch-Mitzenmacher double hashing: bit index of the i-th probe.
+inline uint64_t bloomProbe(uint64_t hash, uint64_t i, uint64_t numBits) {
+    uint64_t hash1 = hash & 0xffffffffull;
+    uint64_t hash2 = (hash >> 32) | 1;
+    return (hash1 + i * hash2) % numBits;
+}
+
+#endif
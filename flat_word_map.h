@@ -0,0 +1,286 @@
+#ifndef FLAT_WORD_MAP_H
+#define FLAT_WORD_MAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "device_tokens.h"
+#include "hugepage.h"
+#include "word_arena.h"
+
+// Open-addressing word -> Value map in the style of Swiss tables. Slots live
+// in parallel arrays: a control byte, the cached 64-bit hash, the key and the
+// value. A probe loads a group of 16 control bytes and matches all of them
+// against 7 bits of the hash with one SSE2 compare, so most lookups read one
+// line of control bytes, and only slots whose cached hash also matches get
+// their key bytes compared. Keys of up to 12 bytes sit inline in their slot;
+// longer keys are copied into the map's arena. Growing reuses the cached
+// hashes instead of rehashing the keys. Lookups take string_view, so finding
+// a word never builds a std::string. There is no erase; counting does not
+// need one.
+namespace FlatMap {
+
+// A murmur3 finalizer over FNV-1a, so the control tag (low 7 bits) and the
+// group index (the bits above) both come out well mixed. Callers that already
+// have the word's fnv1a64 can finish it with mixHash instead of rehashing.
+inline uint64_t mixHash(uint64_t fnv) {
+    fnv ^= fnv >> 33;
+    fnv *= 0xff51afd7ed558ccdull;
+    fnv ^= fnv >> 33;
+    return fnv;
+}
+
+inline uint64_t hashWord(std::string_view word) {
+    return mixHash(fnv1a64(word.data(), static_cast<uint32_t>(word.size())));
+}
+
+template <typename Value>
+class FlatWordMap {
+public:
+    static constexpr size_t groupSize = 16;
+    static constexpr size_t inlineBytes = 12;
+    static constexpr size_t longKeySlabBytes = 1024;
+
+    FlatWordMap() = default;
+
+    explicit FlatWordMap(size_t expectedWords) { reserve(expectedWords); }
+
+    // Written out so the source is left empty: a defaulted move would copy
+    // numWords and leave a map that claims words but has no slots.
+    FlatWordMap(FlatWordMap&& other) noexcept
+        : control(std::move(other.control))
+        , hashes(std::move(other.hashes))
+        , keys(std::move(other.keys))
+        , values(std::move(other.values))
+        , numWords(std::exchange(other.numWords, 0))
+        , longKeys(std::move(other.longKeys)) {}
+
+    FlatWordMap& operator=(FlatWordMap&& other) noexcept {
+        if (this != &other) {
+            control = std::move(other.control);
+            hashes = std::move(other.hashes);
+            keys = std::move(other.keys);
+            values = std::move(other.values);
+            numWords = std::exchange(other.numWords, 0);
+            longKeys = std::move(other.longKeys);
+            other.control.clear();
+            other.hashes.clear();
+            other.keys.clear();
+            other.values.clear();
+        }
+        return *this;
+    }
+
+    size_t size() const { return numWords; }
+
+    bool empty() const { return numWords == 0; }
+
+    size_t capacity() const { return control.size(); }
+
+    void reserve(size_t expectedWords) {
+        while (expectedWords * 8 > capacity() * 7) {
+            grow();
+        }
+    }
+
+    // The value for word, or nullptr.
+    Value* find(std::string_view word) { return find(word, hashWord(word)); }
+    const Value* find(std::string_view word) const { return find(word, hashWord(word)); }
+
+    Value* find(std::string_view word, uint64_t hash) {
+        size_t slot = lookup(word, hash);
+        return slot == notFound ? nullptr : &values[slot];
+    }
+
+    const Value* find(std::string_view word, uint64_t hash) const {
+        size_t slot = lookup(word, hash);
+        return slot == notFound ? nullptr : &values[slot];
+    }
+
+    Value& operator[](std::string_view word) { return findOrInsert(word, hashWord(word)); }
+
+    // For callers that already hashed word with hashWord, e.g. to pick a shard.
+    Value& findOrInsert(std::string_view word, uint64_t hash) {
+        size_t slot = lookup(word, hash);
+        if (slot != notFound) {
+            return values[slot];
+        }
+        if ((numWords + 1) * 8 > capacity() * 7) {
+            grow();
+        }
+        slot = emptySlot(hash);
+        control[slot] = tagOf(hash);
+        hashes[slot] = hash;
+        keys[slot] = makeKey(word);
+        values[slot] = Value();
+        numWords++;
+        return values[slot];
+    }
+
+    // Calls visit(word, value) for every entry, in slot order. The views of
+    // short keys point into the map and are invalidated by the next insert.
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (size_t slot = 0; slot < capacity(); slot++) {
+            if (control[slot] != emptyTag) {
+                visit(keyOf(keys[slot]), values[slot]);
+            }
+        }
+    }
+
+    void clear() {
+        *this = FlatWordMap();
+    }
+
+private:
+    static constexpr size_t notFound = SIZE_MAX;
+    static constexpr int8_t emptyTag = -128;
+
+    // length, then either the bytes themselves or a pointer into the arena.
+    struct Key {
+        uint32_t length;
+        char bytes[inlineBytes];
+    };
+
+    HugePages::HugePageVector<int8_t> control;
+    HugePages::HugePageVector<uint64_t> hashes;
+    HugePages::HugePageVector<Key> keys;
+    HugePages::HugePageVector<Value> values;
+    size_t numWords = 0;
+    std::unique_ptr<WordArena::Arena> longKeys;
+
+    static int8_t tagOf(uint64_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+
+    size_t groupMask() const { return capacity() / groupSize - 1; }
+
+    size_t firstGroup(uint64_t hash) const { return (hash >> 7) & groupMask(); }
+
+    static uint32_t matchTag(const int8_t* group, int8_t tag) {
+#if defined(__SSE2__)
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(tag))));
+#else
+        uint32_t matches = 0;
+        for (size_t i = 0; i < groupSize; i++) {
+            matches |= static_cast<uint32_t>(group[i] == tag) << i;
+        }
+        return matches;
+#endif
+    }
+
+    // Full slots hold a tag in 0..127, so empty ones are exactly those with
+    // the sign bit set.
+    static uint32_t matchEmpty(const int8_t* group) {
+#if defined(__SSE2__)
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))));
+#else
+        return matchTag(group, emptyTag);
+#endif
+    }
+
+    static const char* keyBytes(const Key& key) {
+        if (key.length <= inlineBytes) {
+            return key.bytes;
+        }
+        const char* pointer;
+        std::memcpy(&pointer, key.bytes, sizeof(pointer));
+        return pointer;
+    }
+
+    static std::string_view keyOf(const Key& key) { return std::string_view(keyBytes(key), key.length); }
+
+    Key makeKey(std::string_view word) {
+        Key key;
+        key.length = static_cast<uint32_t>(word.size());
+        if (word.size() <= inlineBytes) {
+            std::memcpy(key.bytes, word.data(), word.size());
+            return key;
+        }
+        // Most maps hold few long keys, so the arena starts with a small slab
+        // and doubles from there instead of taking the default 64 KB per map.
+        if (!longKeys) {
+            longKeys = std::make_unique<WordArena::Arena>(longKeySlabBytes);
+        }
+        const char* pointer = longKeys->intern(word).data();
+        std::memcpy(key.bytes, &pointer, sizeof(pointer));
+        return key;
+    }
+
+    // Groups are visited in triangular order (+1, +2, +3, ...), which covers
+    // every group when their number is a power of two.
+    size_t lookup(std::string_view word, uint64_t hash) const {
+        if (numWords == 0) {
+            return notFound;
+        }
+        int8_t tag = tagOf(hash);
+        size_t group = firstGroup(hash);
+        for (size_t step = 1;; step++) {
+            const int8_t* groupControl = control.data() + group * groupSize;
+            for (uint32_t matches = matchTag(groupControl, tag); matches != 0; matches &= matches - 1) {
+                size_t slot = group * groupSize + __builtin_ctz(matches);
+                if (hashes[slot] == hash && keys[slot].length == word.size() &&
+                    std::memcmp(keyBytes(keys[slot]), word.data(), word.size()) == 0) {
+                    return slot;
+                }
+            }
+            if (matchEmpty(groupControl) != 0) {
+                return notFound;
+            }
+            group = (group + step) & groupMask();
+        }
+    }
+
+    size_t emptySlot(uint64_t hash) const {
+        size_t group = firstGroup(hash);
+        for (size_t step = 1;; step++) {
+            uint32_t empties = matchEmpty(control.data() + group * groupSize);
+            if (empties != 0) {
+                return group * groupSize + __builtin_ctz(empties);
+            }
+            group = (group + step) & groupMask();
+        }
+    }
+
+    void grow() {
+        HugePages::HugePageVector<int8_t> oldControl(std::max<size_t>(2 * capacity(), groupSize), emptyTag);
+        HugePages::HugePageVector<uint64_t> oldHashes(oldControl.size());
+        HugePages::HugePageVector<Key> oldKeys(oldControl.size());
+        HugePages::HugePageVector<Value> oldValues(oldControl.size());
+        control.swap(oldControl);
+        hashes.swap(oldHashes);
+        keys.swap(oldKeys);
+        values.swap(oldValues);
+
+        for (size_t slot = 0; slot < oldControl.size(); slot++) {
+            if (oldControl[slot] != emptyTag) {
+                size_t target = emptySlot(oldHashes[slot]);
+                control[target] = oldControl[slot];
+                hashes[target] = oldHashes[slot];
+                keys[target] = oldKeys[slot];
+                values[target] = std::move(oldValues[slot]);
+            }
+        }
+    }
+};
+
+// (word, value) for every entry, with the words copied out of the map.
+template <typename Value>
+std::vector<std::pair<std::string, Value>> toPairs(const FlatWordMap<Value>& map) {
+    std::vector<std::pair<std::string, Value>> pairs;
+    pairs.reserve(map.size());
+    map.forEach([&](std::string_view word, const Value& value) { pairs.emplace_back(word, value); });
+    return pairs;
+}
+
+}  // namespace FlatMap
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace HugePages {
+
+constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+// Advised only records that madvise(MADV_HUGEPAGE) succeeded; whether the
+// kernel actually backed those ranges with huge pages shows up in
+// AnonHugePages, which report() reads separately.
+enum PageKind { HugeTLB, Advised, Small, NumPageKinds };
+
+// Bytes handed out per page kind since startup, for the report below.
+inline std::atomic<size_t>* usage() {
+    static std::atomic<size_t> bytes[NumPageKinds];
+    return bytes;
+}
+
+inline size_t roundToHugePage(size_t bytes) {
+    return (bytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+}
+
+// Large allocations try explicit 2 MB pages first, then an anonymous mapping
+// advised for transparent huge pages. Anything smaller than one huge page goes
+// through operator new, where a huge page would mostly be wasted.
+inline void* allocate(size_t bytes) {
+    if (bytes < hugePageSize) {
+        usage()[Small] += bytes;
+        return ::operator new(bytes);
+    }
+
+    size_t length = roundToHugePage(bytes);
+    void* memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+        usage()[HugeTLB] += length;
+        return memory;
+    }
+#endif
+
+    memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (madvise(memory, length, MADV_HUGEPAGE) == 0) {
+        usage()[Advised] += length;
+        return memory;
+    }
+#endif
+    usage()[Small] += length;
+    return memory;
+}
+
+inline void deallocate(void* memory, size_t bytes) {
+    if (bytes < hugePageSize) {
+        ::operator delete(memory);
+        return;
+    }
+    munmap(memory, roundToHugePage(bytes));
+}
+
+// Bytes of this process's anonymous memory currently on transparent huge
+// pages, from /proc/self/smaps_rollup; -1 where the kernel does not say.
+inline long long anonHugePageBytes() {
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    const std::string field = "AnonHugePages:";
+    std::string line;
+    while (getline(rollup, line)) {
+        if (line.compare(0, field.size(), field) == 0) {
+            return std::stoll(line.substr(field.size())) * 1024;
+        }
+    }
+    return -1;
+}
+
+inline void report(std::ostream& out) {
+    auto megabytes = [](double bytes) { return bytes / (1024 * 1024); };
+    out << "page sizes: " << megabytes(usage()[HugeTLB]) << " MB on 2 MB hugetlb pages, "
+        << megabytes(usage()[Advised]) << " MB advised for transparent huge pages";
+    long long transparentBytes = anonHugePageBytes();
+    if (transparentBytes >= 0) {
+        out << " (" << megabytes(transparentBytes) << " MB backed by them now)";
+    }
+    out << ", " << megabytes(usage()[Small]) << " MB on 4 KB pages" << std::endl;
+}
+
+template <typename T>
+struct HugePageAllocator {
+    using value_type = T;
+
+    HugePageAllocator() noexcept = default;
+
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(HugePages::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* memory, size_t n) noexcept {
+        HugePages::deallocate(memory, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return false; }
+
+template <typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
+
+}  // namespace HugePages
+
+#endif
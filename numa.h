@@ -0,0 +1,126 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// NUMA topology straight from sysfs, so no libnuma is needed. Memory placement
+// relies on the kernel's first-touch policy: a buffer written by a thread
+// pinned to a node ends up on that node.
+namespace Numa {
+
+struct Node {
+    int id;
+    std::vector<int> cpus;
+};
+
+// Parses a sysfs cpulist such as "0-3,8-11".
+inline std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream stream(list);
+    std::string range;
+
+    while (getline(stream, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+// The CPUs this process may run on (taskset, cgroup cpusets), in order. Empty
+// when the mask cannot be read.
+inline std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return cpus;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// One entry per online node with CPUs this process may use, each listing only
+// those CPUs, so one thread per listed CPU never oversubscribes a restricted
+// process. Falls back to a single node holding every allowed CPU when sysfs
+// has no NUMA information.
+inline std::vector<Node> discoverNodes() {
+    std::vector<Node> nodes;
+    std::vector<int> allowed = allowedCpus();
+    auto isAllowed = [&](int cpu) {
+        return allowed.empty() || std::binary_search(allowed.begin(), allowed.end(), cpu);
+    };
+
+    std::ifstream onlineFile("/sys/devices/system/node/online");
+    std::string online;
+    if (getline(onlineFile, online)) {
+        for (int id : parseCpuList(online)) {
+            std::ifstream cpuListFile("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            std::string cpuList;
+            if (getline(cpuListFile, cpuList)) {
+                std::vector<int> cpus = parseCpuList(cpuList);
+                cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&](int cpu) { return !isAllowed(cpu); }),
+                           cpus.end());
+                if (!cpus.empty()) {
+                    nodes.push_back({id, cpus});
+                }
+            }
+        }
+    }
+
+    if (nodes.empty()) {
+        Node node{0, allowed};
+        if (node.cpus.empty()) {
+            unsigned int numCpus = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned int cpu = 0; cpu < numCpus; cpu++) {
+                node.cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+        nodes.push_back(node);
+    }
+
+    return nodes;
+}
+
+// How many CPUs this process may run on; the default thread count.
+inline size_t usableCpus() {
+    size_t numCpus = 0;
+    for (const auto& node : discoverNodes()) {
+        numCpus += node.cpus.size();
+    }
+    return numCpus;
+}
+
+// Restricts the calling thread to the given CPUs. Failure leaves the thread
+// unpinned, which only costs locality.
+inline bool pinToCpus(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+}  // namespace Numa
+
+#endif
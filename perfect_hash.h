@@ -0,0 +1,272 @@
+#ifndef PERFECT_HASH_H
+#define PERFECT_HASH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "device_tokens.h"
+
+#ifdef SYCL_LANGUAGE_VERSION
+#include <sycl/sycl.hpp>
+#endif
+
+// BBHash-style minimal perfect hash over a fixed dictionary: every word gets a
+// dense id in [0, size()). Level l is a bit array of about gamma * (keys left)
+// bits; keys that land alone on a bit are placed there, colliding keys fall
+// through to level l + 1. A key's id is the rank of its bit across all levels.
+// A 32-bit fingerprint per id rejects non-members, wrongly accepting about one
+// in 2^32 of them.
+namespace PerfectHash {
+
+constexpr uint32_t notFound = UINT32_MAX;
+constexpr uint32_t maxLevels = 32;
+
+inline uint64_t mix(uint64_t hash, uint64_t seed) {
+    hash ^= seed * 0x9e3779b97f4a7c15ull;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Bits set in word. View::slotOf runs inside kernels, where the GCC builtin is
+// not available, so SYCL builds use sycl::popcount.
+inline uint32_t popcount64(uint64_t word) {
+#ifdef SYCL_LANGUAGE_VERSION
+    return static_cast<uint32_t>(sycl::popcount(word));
+#else
+    return static_cast<uint32_t>(__builtin_popcountll(word));
+#endif
+}
+
+inline uint32_t fingerprint(uint64_t hash) {
+    return static_cast<uint32_t>(mix(hash, maxLevels + 1) >> 32);
+}
+
+// Plain pointers and integers only, so a View copied into a SYCL kernel works
+// as long as its arrays live in device-accessible memory.
+struct View {
+    const uint64_t* bits;
+    const uint32_t* ranks;
+    const uint32_t* fingerprints;
+    uint64_t levelOffsets[maxLevels + 1];
+    uint32_t numLevels;
+
+    // The id the bit ranks give hash, without the membership check.
+    uint32_t slotOf(uint64_t hash) const {
+        for (uint32_t level = 0; level < numLevels; level++) {
+            uint64_t levelBits = levelOffsets[level + 1] - levelOffsets[level];
+            uint64_t position = levelOffsets[level] + mix(hash, level) % levelBits;
+            uint64_t word = bits[position / 64];
+            uint64_t bit = position % 64;
+            if ((word >> bit) & 1) {
+                return ranks[position / 64] + popcount64(word & ((1ull << bit) - 1));
+            }
+        }
+        return notFound;
+    }
+
+    // Id of the word whose fnv1a64 hash this is, or notFound.
+    uint32_t lookup(uint64_t hash) const {
+        uint32_t id = slotOf(hash);
+        return id != notFound && fingerprints[id] == fingerprint(hash) ? id : notFound;
+    }
+
+    uint32_t lookup(const char* word, uint32_t length) const {
+        return lookup(fnv1a64(word, length));
+    }
+};
+
+class MinimalPerfectHash {
+public:
+    MinimalPerfectHash() = default;
+
+    template <typename Container>
+    explicit MinimalPerfectHash(const Container& words, double gamma = 2.0) {
+        std::vector<uint64_t> hashes;
+        hashes.reserve(words.size());
+        for (const auto& word : words) {
+            hashes.push_back(fnv1a64(word.data(), static_cast<uint32_t>(word.size())));
+        }
+        std::sort(hashes.begin(), hashes.end());
+        hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+        build(hashes, gamma);
+    }
+
+    size_t size() const { return fingerprints.size(); }
+
+    View view() const {
+        return viewWith(bits.data(), ranks.data(), fingerprints.data());
+    }
+
+    // The same function over copies of the arrays elsewhere, e.g. in device
+    // memory; see bitArray(), rankArray() and fingerprintArray().
+    View viewWith(const uint64_t* bitsCopy, const uint32_t* ranksCopy, const uint32_t* fingerprintsCopy) const {
+        View view;
+        view.bits = bitsCopy;
+        view.ranks = ranksCopy;
+        view.fingerprints = fingerprintsCopy;
+        view.numLevels = static_cast<uint32_t>(levelOffsets.size() - 1);
+        std::copy(levelOffsets.begin(), levelOffsets.end(), view.levelOffsets);
+        return view;
+    }
+
+    uint32_t lookup(std::string_view word) const {
+        return view().lookup(word.data(), static_cast<uint32_t>(word.size()));
+    }
+
+    const std::vector<uint64_t>& bitArray() const { return bits; }
+    const std::vector<uint32_t>& rankArray() const { return ranks; }
+    const std::vector<uint32_t>& fingerprintArray() const { return fingerprints; }
+
+    void save(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        writeVector(out, levelOffsets);
+        writeVector(out, bits);
+        writeVector(out, ranks);
+        writeVector(out, fingerprints);
+        if (!out) {
+            throw std::runtime_error("could not write perfect hash '" + path + "'");
+        }
+    }
+
+    // False when the file is missing or malformed.
+    bool load(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!readVector(in, levelOffsets) || !readVector(in, bits) || !readVector(in, ranks) ||
+            !readVector(in, fingerprints)) {
+            return false;
+        }
+        if (levelOffsets.empty() || levelOffsets.size() > maxLevels + 1 || levelOffsets.back() != bits.size() * 64 ||
+            ranks.size() != bits.size()) {
+            return false;
+        }
+        size_t placedKeys = bits.empty() ? 0 : ranks.back() + __builtin_popcountll(bits.back());
+        return fingerprints.size() == placedKeys;
+    }
+
+private:
+    std::vector<uint64_t> levelOffsets{0};
+    std::vector<uint64_t> bits;
+    std::vector<uint32_t> ranks;
+    std::vector<uint32_t> fingerprints;
+
+    void build(std::vector<uint64_t> remaining, double gamma) {
+        std::vector<uint64_t> keys = remaining;
+
+        while (!remaining.empty()) {
+            if (levelOffsets.size() > maxLevels) {
+                throw std::runtime_error("perfect hash construction did not converge");
+            }
+            uint32_t level = static_cast<uint32_t>(levelOffsets.size() - 1);
+            size_t levelWords = std::max<size_t>(1, static_cast<size_t>(gamma * remaining.size() + 63) / 64);
+            uint64_t levelBits = levelWords * 64;
+
+            std::vector<uint64_t> seen(levelWords, 0);
+            std::vector<uint64_t> collided(levelWords, 0);
+            for (uint64_t hash : remaining) {
+                uint64_t position = mix(hash, level) % levelBits;
+                uint64_t mask = 1ull << (position % 64);
+                if (seen[position / 64] & mask) {
+                    collided[position / 64] |= mask;
+                }
+                seen[position / 64] |= mask;
+            }
+
+            std::vector<uint64_t> next;
+            for (uint64_t hash : remaining) {
+                uint64_t position = mix(hash, level) % levelBits;
+                if (collided[position / 64] & (1ull << (position % 64))) {
+                    next.push_back(hash);
+                }
+            }
+            for (size_t w = 0; w < levelWords; w++) {
+                bits.push_back(seen[w] & ~collided[w]);
+            }
+            levelOffsets.push_back(levelOffsets.back() + levelBits);
+            remaining.swap(next);
+        }
+
+        ranks.resize(bits.size());
+        uint32_t rank = 0;
+        for (size_t w = 0; w < bits.size(); w++) {
+            ranks[w] = rank;
+            rank += __builtin_popcountll(bits[w]);
+        }
+
+        fingerprints.assign(keys.size(), 0);
+        View placed = view();
+        for (uint64_t hash : keys) {
+            fingerprints[placed.slotOf(hash)] = fingerprint(hash);
+        }
+    }
+
+    template <typename T>
+    static void writeVector(std::ofstream& out, const std::vector<T>& values) {
+        uint64_t count = values.size();
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char*>(values.data()), count * sizeof(T));
+    }
+
+    template <typename T>
+    static bool readVector(std::ifstream& in, std::vector<T>& values) {
+        uint64_t count = 0;
+        if (!in.read(reinterpret_cast<char*>(&count), sizeof(count)) || count > (1ull << 40) / sizeof(T)) {
+            return false;
+        }
+        values.resize(count);
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(values.data()), count * sizeof(T)));
+    }
+};
+
+// The perfect hash over words. It is loaded from path when that file holds one
+// that places every word, and otherwise built and, if a path is given, saved
+// there. wordsById[id] is the word behind each id. Ids come from the words'
+// fnv1a64 hashes, which device lookups compute too, so two words sharing a
+// hash cannot be told apart by re-seeding; building then throws instead of
+// handing out an id that stands for both.
+template <typename Container>
+MinimalPerfectHash loadOrBuild(const Container& words, const std::string& path, std::vector<std::string>& wordsById) {
+    MinimalPerfectHash index;
+    auto placeWords = [&]() {
+        wordsById.assign(index.size(), std::string());
+        std::vector<bool> placed(index.size(), false);
+        size_t numPlaced = 0;
+        for (const auto& word : words) {
+            uint32_t id = index.lookup(word);
+            if (id == notFound || (placed[id] && wordsById[id] != word)) {
+                return false;
+            }
+            if (!placed[id]) {
+                placed[id] = true;
+                wordsById[id] = word;
+                numPlaced++;
+            }
+        }
+        return numPlaced == index.size();
+    };
+
+    if (!path.empty() && index.load(path) && placeWords()) {
+        return index;
+    }
+    index = MinimalPerfectHash(words);
+    if (!placeWords()) {
+        throw std::runtime_error("perfect hash could not give every dictionary word its own id");
+    }
+    if (!path.empty()) {
+        index.save(path);
+    }
+    return index;
+}
+
+}  // namespace PerfectHash
+
+#endif
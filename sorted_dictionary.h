@@ -0,0 +1,139 @@
+#ifndef SORTED_DICTIONARY_H
+#define SORTED_DICTIONARY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "device_tokens.h"
+#include "hugepage.h"
+
+// Exact dictionary membership without per-node pointers. Each word becomes a
+// (hash, offset, length) entry; the entries are sorted by hash and stored in
+// Eytzinger (breadth-first) order, with the hashes in their own array so
+// eight of them share a cache line. The first levels of every search then hit
+// the same few lines, and the next levels are prefetched before they are
+// needed. The words themselves sit in one string pool, each padded to a
+// 16-byte boundary so the final check compares whole vector registers.
+namespace SortedDictionary {
+
+class EytzingerDictionary {
+public:
+    EytzingerDictionary() : hashes(1), tree(1) {}
+
+    // Words may come in any order and with duplicates.
+    template <typename Container>
+    explicit EytzingerDictionary(const Container& words) {
+        std::vector<std::pair<uint64_t, std::string_view>> sorted;
+        sorted.reserve(words.size());
+        for (const auto& word : words) {
+            sorted.emplace_back(hashWord(word), word);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+        // The tree holds one entry per hash; distinct words that share a
+        // 64-bit hash (practically never) go to a side list.
+        std::vector<std::pair<uint64_t, Entry>> entries;
+        entries.reserve(sorted.size());
+        for (const auto& [hash, word] : sorted) {
+            if (!entries.empty() && entries.back().first == hash) {
+                collisions.emplace_back(word);
+                continue;
+            }
+            entries.push_back({hash, {static_cast<uint32_t>(pool.size()), static_cast<uint32_t>(word.size())}});
+            pool.insert(pool.end(), word.begin(), word.end());
+            pool.resize((pool.size() + 15) / 16 * 16 + 16, '\0');
+        }
+
+        hashes.resize(entries.size() + 1);
+        tree.resize(entries.size() + 1);
+        size_t next = 0;
+        place(entries, next, 1);
+    }
+
+    size_t size() const { return tree.size() - 1 + collisions.size(); }
+
+    size_t memoryBytes() const {
+        return hashes.size() * sizeof(uint64_t) + tree.size() * sizeof(Entry) + pool.size();
+    }
+
+    bool contains(std::string_view word) const {
+        uint64_t hash = hashWord(word);
+        size_t n = tree.size() - 1;
+        size_t k = 1;
+        // Branchless descent: the comparison picks the child arithmetically,
+        // and the prefetch pulls in the hashes four levels further down.
+        while (k <= n) {
+            __builtin_prefetch(hashes.data() + std::min(16 * k, n));
+            k = 2 * k + (hashes[k] < hash);
+        }
+        // Undo the trailing right turns to land on the lower bound.
+        k >>= __builtin_ffsll(~k);
+
+        if (k != 0 && hashes[k] == hash && tree[k].length == word.size() &&
+            equalPadded(pool.data() + tree[k].offset, word)) {
+            return true;
+        }
+        return !collisions.empty() && std::find(collisions.begin(), collisions.end(), word) != collisions.end();
+    }
+
+    size_t count(std::string_view word) const { return contains(word) ? 1 : 0; }
+
+private:
+    struct Entry {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    HugePages::HugePageVector<uint64_t> hashes;
+    HugePages::HugePageVector<Entry> tree;
+    HugePages::HugePageVector<char> pool;
+    std::vector<std::string> collisions;
+
+    static uint64_t hashWord(std::string_view word) {
+        return fnv1a64(word.data(), static_cast<uint32_t>(word.size()));
+    }
+
+    // In-order walk of the implicit tree fills it from the sorted entries.
+    void place(const std::vector<std::pair<uint64_t, Entry>>& entries, size_t& next, size_t k) {
+        if (k >= tree.size()) {
+            return;
+        }
+        place(entries, next, 2 * k);
+        hashes[k] = entries[next].first;
+        tree[k] = entries[next++].second;
+        place(entries, next, 2 * k + 1);
+    }
+
+    // stored is zero-padded to a multiple of 16 bytes; word is copied into a
+    // padded buffer so both sides can be loaded whole.
+    static bool equalPadded(const char* stored, std::string_view word) {
+#if defined(__SSE2__)
+        if (word.size() < 64) {
+            alignas(16) char padded[64] = {};
+            std::memcpy(padded, word.data(), word.size());
+            for (size_t i = 0; i < word.size(); i += 16) {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stored + i));
+                __m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(padded + i));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff) {
+                    return false;
+                }
+            }
+            return true;
+        }
+#endif
+        return std::memcmp(stored, word.data(), word.size()) == 0;
+    }
+};
+
+}  // namespace SortedDictionary
+
+#endif
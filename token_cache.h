@@ -0,0 +1,307 @@
+#ifndef TOKEN_CACHE_H
+#define TOKEN_CACHE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hugepage.h"
+#include "token_dictionary.h"
+#include "word_arena.h"
+
+// On-disk tokenized corpus, so repeat runs over the same input skip reading
+// and tokenizing it. The cache sits next to the source as
+// <source>.w<minimumWordLength>.tokcache and holds the vocabulary and the
+// token id stream. Ids are renumbered by descending frequency and stored as
+// LEB128 varints, which puts the common words in one byte each.
+//
+// Layout: Header, then (vocabularySize + 1) uint32 offsets into the string
+// pool, the pool itself, and streamBytes of varint ids.
+namespace TokenCache {
+
+constexpr char magic[8] = {'W', 'C', 'T', 'O', 'K', 'C', '0', '1'};
+
+struct Header {
+    char magic[8];
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    uint64_t contentHash;
+    uint64_t minimumWordLength;
+    uint64_t vocabularySize;
+    uint64_t tokenCount;
+    uint64_t poolBytes;
+    uint64_t streamBytes;
+};
+
+// Read-only mapping of a whole file; empty when the file cannot be mapped.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = static_cast<const char*>(mapped);
+                length = info.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data) {
+            munmap(const_cast<char*>(data), length);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data = nullptr;
+    size_t length = 0;
+};
+
+// words[id] is the token behind id. Loaded from a cache, the views point
+// straight into the mapped pool and only the varint ids are decoded; a freshly
+// encoded corpus keeps its words in its own arena.
+struct EncodedCorpus {
+    std::vector<std::string_view> words;
+    HugePages::HugePageVector<uint32_t> ids;
+    std::unique_ptr<MappedFile> mapping;
+    std::unique_ptr<WordArena::Arena> arena;
+
+    // Copies words into the corpus's arena and points the views at the copies.
+    void keepWords(const std::vector<std::string>& owned) {
+        size_t bytes = 0;
+        for (const auto& word : owned) {
+            bytes += word.size();
+        }
+        arena = std::make_unique<WordArena::Arena>(bytes);
+        words.clear();
+        words.reserve(owned.size());
+        for (const auto& word : owned) {
+            words.push_back(arena->intern(word));
+        }
+    }
+};
+
+// Hashes the source eight bytes at a time; only reads it, so it is much
+// cheaper than tokenizing.
+inline uint64_t hashContents(const MappedFile& file) {
+    uint64_t hash = 14695981039346656037ull ^ file.length;
+    size_t i = 0;
+    for (; i + 8 <= file.length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, file.data + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 31;
+    }
+    for (; i < file.length; i++) {
+        hash = (hash ^ static_cast<unsigned char>(file.data[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+inline std::string cachePath(const std::string& sourcePath, size_t minimumWordLength) {
+    return sourcePath + ".w" + std::to_string(minimumWordLength) + ".tokcache";
+}
+
+inline void putVarint(std::string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// The header a cache for this source must carry; false if the source is missing.
+inline bool describeSource(const std::string& sourcePath, size_t minimumWordLength, Header& header) {
+    struct stat info;
+    if (stat(sourcePath.c_str(), &info) != 0) {
+        return false;
+    }
+    MappedFile source(sourcePath);
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.sourceSize = info.st_size;
+    header.sourceMtimeNs = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    header.contentHash = hashContents(source);
+    header.minimumWordLength = minimumWordLength;
+    return true;
+}
+
+// Loads the cache for sourcePath if one exists and still matches the source's
+// size, mtime and content hash. A cache whose sizes, offsets or ids do not add
+// up is treated like a stale one, so the caller rebuilds it.
+inline bool load(const std::string& sourcePath, size_t minimumWordLength, EncodedCorpus& corpus) {
+    auto mapping = std::make_unique<MappedFile>(cachePath(sourcePath, minimumWordLength));
+    const MappedFile& cache = *mapping;
+    Header expected;
+    if (!cache.data || cache.length < sizeof(Header) || !describeSource(sourcePath, minimumWordLength, expected)) {
+        return false;
+    }
+    Header header;
+    std::memcpy(&header, cache.data, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.sourceSize != expected.sourceSize ||
+        header.sourceMtimeNs != expected.sourceMtimeNs || header.contentHash != expected.contentHash ||
+        header.minimumWordLength != minimumWordLength) {
+        return false;
+    }
+    // Ids are uint32, and every token takes at least one varint byte; with
+    // each size bounded by the file, the sum below cannot overflow.
+    size_t available = cache.length - sizeof(Header);
+    if (header.vocabularySize >= UINT32_MAX || header.poolBytes > available || header.streamBytes > available ||
+        header.tokenCount > header.streamBytes) {
+        return false;
+    }
+    size_t offsetsBytes = (header.vocabularySize + 1) * sizeof(uint32_t);
+    if (available != offsetsBytes + header.poolBytes + header.streamBytes) {
+        return false;
+    }
+
+    const char* offsets = cache.data + sizeof(Header);
+    const char* pool = offsets + offsetsBytes;
+    corpus.words.resize(header.vocabularySize);
+    for (size_t id = 0; id < header.vocabularySize; id++) {
+        uint32_t begin, end;
+        std::memcpy(&begin, offsets + id * sizeof(uint32_t), sizeof(begin));
+        std::memcpy(&end, offsets + (id + 1) * sizeof(uint32_t), sizeof(end));
+        if (begin > end || end > header.poolBytes) {
+            return false;
+        }
+        corpus.words[id] = std::string_view(pool + begin, end - begin);
+    }
+
+    const unsigned char* stream = reinterpret_cast<const unsigned char*>(pool + header.poolBytes);
+    const unsigned char* streamEnd = stream + header.streamBytes;
+    corpus.ids.resize(header.tokenCount);
+    for (size_t t = 0; t < header.tokenCount; t++) {
+        uint32_t value = 0;
+        bool complete = false;
+        for (int shift = 0; !complete; shift += 7) {
+            if (stream == streamEnd || shift >= 32) {
+                return false;
+            }
+            unsigned char byte = *stream++;
+            value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            complete = !(byte & 0x80);
+        }
+        if (value >= header.vocabularySize) {
+            return false;
+        }
+        corpus.ids[t] = value;
+    }
+    if (stream != streamEnd) {
+        return false;
+    }
+    corpus.mapping = std::move(mapping);
+    return true;
+}
+
+// Encodes tokens, renumbers ids by frequency and writes the cache. A cache
+// that cannot be written only costs the next run a re-tokenization.
+inline EncodedCorpus build(const std::string& sourcePath, size_t minimumWordLength,
+                           const std::vector<std::string_view>& tokens, size_t numThreads) {
+    TokenDictionary::InterningTable dictionary;
+    HugePages::HugePageVector<uint32_t> firstSeenIds;
+    TokenDictionary::encodeTokens(dictionary, tokens, firstSeenIds, numThreads);
+
+    std::vector<uint32_t> counts(dictionary.size(), 0);
+    for (uint32_t id : firstSeenIds) {
+        counts[id]++;
+    }
+    std::vector<std::string> words = dictionary.words();
+    std::vector<uint32_t> order = TokenDictionary::rankByCount(counts, words);
+    std::vector<uint32_t> renumbered(order.size());
+
+    std::vector<std::string> rankedWords(order.size());
+    for (uint32_t rank = 0; rank < order.size(); rank++) {
+        renumbered[order[rank]] = rank;
+        rankedWords[rank] = std::move(words[order[rank]]);
+    }
+    EncodedCorpus corpus;
+    corpus.keepWords(rankedWords);
+    corpus.ids.resize(firstSeenIds.size());
+    for (size_t t = 0; t < firstSeenIds.size(); t++) {
+        corpus.ids[t] = renumbered[firstSeenIds[t]];
+    }
+
+    Header header;
+    if (!describeSource(sourcePath, minimumWordLength, header)) {
+        return corpus;
+    }
+    std::vector<uint32_t> offsets(1, 0);
+    std::string pool;
+    for (const auto& word : corpus.words) {
+        pool += word;
+        offsets.push_back(static_cast<uint32_t>(pool.size()));
+    }
+    std::string stream;
+    for (uint32_t id : corpus.ids) {
+        putVarint(stream, id);
+    }
+    header.vocabularySize = corpus.words.size();
+    header.tokenCount = corpus.ids.size();
+    header.poolBytes = pool.size();
+    header.streamBytes = stream.size();
+
+    // Written under a unique temporary name and renamed, so readers never map
+    // a half-written cache and concurrent runs do not write into one file.
+    std::string path = cachePath(sourcePath, minimumWordLength);
+    std::string temporaryPath = path + ".XXXXXX";
+    int fd = mkstemp(temporaryPath.data());
+    if (fd < 0) {
+        std::cerr << "Warning: Could not write token cache '" << path << "'." << "\n";
+        return corpus;
+    }
+    // mkstemp creates the file 0600 and the rename keeps that; give the cache
+    // the mode a plain create would, so other users can read it too.
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0644 & ~mask);
+    close(fd);
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint32_t));
+    out.write(pool.data(), pool.size());
+    out.write(stream.data(), stream.size());
+    out.close();
+    if (!out || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "Warning: Could not write token cache '" << path << "'." << "\n";
+        std::remove(temporaryPath.c_str());
+    }
+    return corpus;
+}
+
+// The cached corpus when it is current; otherwise tokenize() supplies the
+// tokens, as a WordLoader::LoadedWords, and a fresh cache is written for the
+// next run.
+template <typename Tokenize>
+EncodedCorpus loadOrBuild(const std::string& sourcePath, size_t minimumWordLength, size_t numThreads,
+                          Tokenize tokenize) {
+    EncodedCorpus corpus;
+    if (load(sourcePath, minimumWordLength, corpus)) {
+        return corpus;
+    }
+    return build(sourcePath, minimumWordLength, tokenize().tokens, numThreads);
+}
+
+}  // namespace TokenCache
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef TOKEN_DICTIONARY_H
+#define TOKEN_DICTIONARY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "flat_word_map.h"
+#include "hugepage.h"
+
+// Dictionary encoding: every distinct token gets a dense uint32 id once, right
+// after tokenization, so counting, sorting and top-K run on integer arrays and
+// strings only come back for the final output.
+namespace TokenDictionary {
+
+// Concurrent string -> id table. Keys are spread over independently locked
+// shards; ids come from one atomic counter, so they stay dense (0..size()-1)
+// whichever thread interns a word first. The shard is picked from the same
+// hash its map uses, and the map keeps its own copy of every word.
+class InterningTable {
+public:
+    static constexpr size_t numShards = 64;
+
+    uint32_t intern(std::string_view word) { return intern(word, FlatMap::hashWord(word)); }
+
+    // For callers that already hashed word with hashWord.
+    uint32_t intern(std::string_view word, uint64_t hash) {
+        Shard& shard = shards[(hash >> 32) % numShards];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        if (const uint32_t* found = shard.ids.find(word, hash)) {
+            return *found;
+        }
+        uint32_t id = nextId.fetch_add(1);
+        shard.ids.findOrInsert(word, hash) = id;
+        return id;
+    }
+
+    size_t size() const { return nextId.load(); }
+
+    // words()[id] is the token interned as id. Not safe to call while other
+    // threads are still interning.
+    std::vector<std::string> words() const {
+        std::vector<std::string> byId(size());
+        for (const auto& shard : shards) {
+            shard.ids.forEach([&](std::string_view word, uint32_t id) { byId[id] = std::string(word); });
+        }
+        return byId;
+    }
+
+private:
+    struct Shard {
+        std::mutex lock;
+        FlatMap::FlatWordMap<uint32_t> ids;
+    };
+
+    Shard shards[numShards];
+    std::atomic<uint32_t> nextId{0};
+};
+
+// Interns tokens on numThreads threads and appends their ids, in token order,
+// to ids: the token stream at 4 bytes per token. Each worker remembers the ids
+// it has seen in a map of its own, so only its first sight of a word takes a
+// shard lock.
+inline void encodeTokens(InterningTable& table, const std::vector<std::string_view>& tokens,
+                         HugePages::HugePageVector<uint32_t>& ids, size_t numThreads) {
+    size_t base = ids.size();
+    ids.resize(base + tokens.size());
+    numThreads = std::max<size_t>(std::min(numThreads, tokens.size()), 1);
+
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < numThreads; w++) {
+        workers.emplace_back([&, w]() {
+            size_t begin = tokens.size() * w / numThreads;
+            size_t end = tokens.size() * (w + 1) / numThreads;
+            FlatMap::FlatWordMap<uint32_t> seen;
+            for (size_t i = begin; i < end; i++) {
+                uint64_t hash = FlatMap::hashWord(tokens[i]);
+                if (const uint32_t* found = seen.find(tokens[i], hash)) {
+                    ids[base + i] = *found;
+                    continue;
+                }
+                uint32_t id = table.intern(tokens[i], hash);
+                seen.findOrInsert(tokens[i], hash) = id;
+                ids[base + i] = id;
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Ids ordered by descending count, ties by word. Ids depend on which thread
+// interned a word first, so they cannot break ties reproducibly.
+template <typename Counts, typename Words>
+std::vector<uint32_t> rankByCount(const Counts& counts, const Words& words) {
+    std::vector<uint32_t> order(counts.size());
+    for (uint32_t id = 0; id < order.size(); id++) {
+        order[id] = id;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return counts[a] != counts[b] ? counts[a] > counts[b] : words[a] < words[b];
+    });
+    return order;
+}
+
+// The only place strings reappear: (word, count) for each id in order.
+template <typename Counts, typename Words>
+std::vector<std::pair<std::string, int>> materialize(const std::vector<uint32_t>& order, const Counts& counts,
+                                                     const Words& words) {
+    std::vector<std::pair<std::string, int>> wordCountPairs;
+    wordCountPairs.reserve(order.size());
+    for (uint32_t id : order) {
+        wordCountPairs.emplace_back(words[id], static_cast<int>(counts[id]));
+    }
+    return wordCountPairs;
+}
+
+}  // namespace TokenDictionary
+
+#endif
@@ -1,8 +1,20 @@
+#ifndef WC_NO_SYCL
 #include <sycl/sycl.hpp>
+#endif
+#include "CLI11.hpp"
+#include "counting_engine.h"
+#include "device_tokens.h"
+#include "flat_word_map.h"
+#include "hugepage.h"
+#include "numa.h"
+#include "token_cache.h"
+#include "token_dictionary.h"
+#include "word_loader.h"
 #include <iomanip>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <algorithm>
 #include <random>
@@ -10,12 +22,24 @@
 #include <unordered_map>
 #include <vector>
 #include <utility>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#if (defined(__AVX2__) || defined(__SSE2__)) && !defined(__SYCL_DEVICE_ONLY__)
+#include <immintrin.h>
+#endif
 
 
+#ifndef WC_NO_SYCL
 using namespace sycl;
+#endif
 using namespace std;
 
 
+#ifndef WC_NO_SYCL
 // From oneAPI tutorial
 class CustomDeviceSelector {
  public:
@@ -35,25 +59,51 @@ class CustomDeviceSelector {
  private:
   std::string vendorName_;
 };
+#endif
 
 
-vector<string> readWordsFromFile(const string &path, size_t minimumWordLength) {
-    vector<string> words;
+// Input read per batch when a host engine is fed through ingest().
+constexpr size_t hostBatchBytes = 16 << 20;
+
+// Reads the corpus a line at a time and hands consume() the accepted tokens of
+// each stretch of about batchBytes of input, stopping after about maxBytes.
+// A batch's words live in its own arena, which consume() may keep by moving
+// the batch out; otherwise it is freed once consume() returns, so memory stays
+// bounded by the batch size however large the file is.
+template <typename Consume>
+void readWordBatches(const string &path, size_t minimumWordLength, size_t batchBytes, size_t maxBytes,
+                     Consume consume) {
     string line, word;
     ifstream inputFile;
+    size_t bytesRead = 0;
 
     inputFile.open(path);
 
     if (inputFile.is_open()) {
-        while (getline(inputFile, line)) {
+        size_t arenaBytes = std::min({WordLoader::fileBytes(path), batchBytes, maxBytes});
+        WordLoader::LoadedWords batch;
+        batch.arena = make_unique<WordArena::Arena>(arenaBytes);
+        size_t batchRead = 0;
+        while (bytesRead < maxBytes && getline(inputFile, line)) {
+            bytesRead += line.size() + 1;
+            batchRead += line.size() + 1;
             transform(line.begin(), line.end(), line.begin(), ::toupper);
             istringstream lineStream(line);
 
             while (lineStream >> word) {
                 if (word.length() >= minimumWordLength && word.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ") == string::npos) {
-                    words.push_back(word);
+                    batch.tokens.push_back(batch.arena->intern(word));
                 }
             }
+            if (batchRead >= batchBytes) {
+                consume(batch);
+                batch = WordLoader::LoadedWords();
+                batch.arena = make_unique<WordArena::Arena>(arenaBytes);
+                batchRead = 0;
+            }
+        }
+        if (!batch.tokens.empty()) {
+            consume(batch);
         }
     } else {
         cerr << "Error: Could not open file '" << path << "'." << "\n";
@@ -61,7 +111,15 @@ vector<string> readWordsFromFile(const string &path, size_t minimumWordLength) {
     }
 
     inputFile.close();
+}
 
+// The whole corpus, or about its first maxBytes, which the engine auto-selector
+// uses to sample the start of a corpus. Only the tokens view is filled; its
+// words live in the returned arena.
+WordLoader::LoadedWords readWordsFromFile(const string &path, size_t minimumWordLength, size_t maxBytes = SIZE_MAX) {
+    WordLoader::LoadedWords words;
+    readWordBatches(path, minimumWordLength, SIZE_MAX, maxBytes,
+                    [&](WordLoader::LoadedWords &batch) { words = std::move(batch); });
     return words;
 }
 
@@ -74,33 +132,133 @@ vector<string> readWordsFromFile(const string &path, size_t minimumWordLength) {
 //     return wordCounts;
 // }
 
+// A word of up to 31 bytes, zero-padded to 32 so equality is a fixed-width
+// block compare. The cached length and 32-bit hash prefix reject almost every
+// mismatch with one integer compare before the bytes are looked at.
 struct StringData {
-    char data[32];
+    char data[32] = {};
+    uint32_t length = 0;
+    uint32_t prefix = 0;
+
+    StringData() = default;
 
-    StringData() {
-        data[0] = '\0';
+    StringData(std::string_view str) {
+        length = static_cast<uint32_t>(std::min(str.size(), sizeof(data) - 1));
+        std::memcpy(data, str.data(), length);
+        prefix = hashPrefix(data, length);
     }
 
-    StringData(const std::string &str) {
-        std::strncpy(data, str.c_str(), sizeof(data));
-        data[sizeof(data) - 1] = '\0';
+    static uint32_t hashPrefix(const char *bytes, uint32_t length) {
+        uint64_t hash = fnv1a64(bytes, length);
+        return static_cast<uint32_t>(hash ^ (hash >> 32));
     }
 
     bool operator==(const StringData &other) const {
-        return std::strncmp(data, other.data, sizeof(data)) == 0;
+        if (prefix != other.prefix || length != other.length) {
+            return false;
+        }
+#if defined(__AVX2__) && !defined(__SYCL_DEVICE_ONLY__)
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(other.data));
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) == -1;
+#elif defined(__SSE2__) && !defined(__SYCL_DEVICE_ONLY__)
+        __m128i low = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data)),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i *>(other.data)));
+        __m128i high = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16)),
+                                      _mm_loadu_si128(reinterpret_cast<const __m128i *>(other.data + 16)));
+        return _mm_movemask_epi8(_mm_and_si128(low, high)) == 0xffff;
+#else
+        // Device code: four 64-bit lanes folded without branches, which the
+        // SYCL compiler turns into vector loads and one reduction.
+        uint64_t difference = 0;
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t a, b;
+            std::memcpy(&a, data + 8 * lane, sizeof(a));
+            std::memcpy(&b, other.data + 8 * lane, sizeof(b));
+            difference |= a ^ b;
+        }
+        return difference == 0;
+#endif
     }
 };
 
 
-void countWordOccurrences(sycl::queue &q, const std::vector<StringData> &words,
-                          const std::vector<StringData> &uniqueWords,
-                          std::vector<int> &wordCounts) {
+// Host-side staging for the kernel; large corpora get huge pages so the
+// runtime's copies in and out do not thrash the TLB.
+template <typename T>
+using HostVector = HugePages::HugePageVector<T>;
+
+
+vector<pair<string, int>> mapToVector(const FlatMap::FlatWordMap<int> &wordCounts) {
+    return FlatMap::toPairs(wordCounts);
+}
+
+
+// Descending count, ties by word, the same order TokenDictionary::rankByCount
+// gives, so every engine prints identical output.
+bool compareWordCounts(const pair<string, int> &a, const pair<string, int> &b) {
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+}
+
+
+// The corpus as vocabulary plus id stream. With useCache it comes from the
+// on-disk token cache when that is current, and refreshes the cache when not.
+TokenCache::EncodedCorpus encodeCorpus(const string &path, size_t minimumWordLength, size_t numThreads,
+                                       bool useCache) {
+    auto tokenize = [&]() { return readWordsFromFile(path, minimumWordLength); };
+    if (useCache) {
+        return TokenCache::loadOrBuild(path, minimumWordLength, numThreads, tokenize);
+    }
+    TokenCache::EncodedCorpus corpus;
+    TokenDictionary::InterningTable dictionary;
+    TokenDictionary::encodeTokens(dictionary, tokenize().tokens, corpus.ids, numThreads);
+    corpus.keepWords(dictionary.words());
+    return corpus;
+}
+
+
+// Everything from here to main needs a SYCL runtime; build with -DWC_NO_SYCL
+// to get a binary that only has the host engines.
+#ifndef WC_NO_SYCL
+
+using KernelBundle = sycl::kernel_bundle<sycl::bundle_state::executable>;
+
+// Builds every kernel in the program for q's device on a background thread.
+// With AOT images (see job_1.sh) this only loads them; on the JIT fallback it
+// compiles the SPIR-V. Either way the cost overlaps with reading the corpus
+// instead of landing on the first submit.
+std::shared_future<KernelBundle> warmUpKernels(sycl::queue &q) {
+    return std::async(std::launch::async, [&q]() {
+               return sycl::get_kernel_bundle<sycl::bundle_state::executable>(q.get_context(), {q.get_device()});
+           })
+        .share();
+}
+
+// Submits a kernel from the bundle warmUpKernels built, so the runtime runs
+// the images it already has rather than building them again. The first
+// submit blocks until the warm-up has finished; a default constructed future
+// submits without a bundle.
+template <typename CommandGroup>
+sycl::event submitKernel(sycl::queue &q, const std::shared_future<KernelBundle> &kernelsReady,
+                         CommandGroup commandGroup) {
+    return q.submit([&](sycl::handler &h) {
+        if (kernelsReady.valid()) {
+            h.use_kernel_bundle(kernelsReady.get());
+        }
+        commandGroup(h);
+    });
+}
+
+void countWordOccurrences(sycl::queue &q, const HostVector<StringData> &words,
+                          const HostVector<StringData> &uniqueWords,
+                          HostVector<int> &wordCounts,
+                          const std::shared_future<KernelBundle> &kernelsReady) {
 
     sycl::buffer inputWordsBuffer(words.data(), sycl::range<1>(words.size()));
     sycl::buffer uniqueWordsBuffer(uniqueWords.data(), sycl::range<1>(uniqueWords.size()));
     sycl::buffer wordCountsBuffer(wordCounts.data(), sycl::range<1>(wordCounts.size()));
 
-    q.submit([&](sycl::handler &h) {
+    submitKernel(q, kernelsReady, [&](sycl::handler &h) {
         auto inputWordsAccessor = inputWordsBuffer.get_access<sycl::access::mode::read>(h);
         auto uniqueWordsAccessor = uniqueWordsBuffer.get_access<sycl::access::mode::read>(h);
         auto wordCountsAccessor = wordCountsBuffer.get_access<sycl::access::mode::read_write>(h);
@@ -122,56 +280,1260 @@ void countWordOccurrences(sycl::queue &q, const std::vector<StringData> &words,
 }
 
 
+// Where the USM variant keeps its arrays. Shared placement hands the kernel the
+// very pages the host filled; Device placement stages through pinned host
+// memory and copies asynchronously into device memory.
+enum class UsmPlacement { Shared, Device };
 
-vector<pair<string, int>> mapToVector(const unordered_map<string, int> &wordCounts) {
-    vector<pair<string, int>> wordCountVector(wordCounts.begin(), wordCounts.end());
-    return wordCountVector;
+// Chosen once at startup from the device's aspects: a CPU device runs on the
+// host's own memory, so shared allocations there are zero-copy.
+UsmPlacement chooseUsmPlacement(const sycl::device &dev) {
+    if (dev.is_cpu() && dev.has(sycl::aspect::usm_shared_allocations)) {
+        return UsmPlacement::Shared;
+    }
+    return UsmPlacement::Device;
 }
 
+// Host-writable array for countWordOccurrencesUSM inputs and results.
+template <typename T>
+T *allocateHostVisible(sycl::queue &q, UsmPlacement placement, size_t count) {
+    count = std::max<size_t>(count, 1);
+    return placement == UsmPlacement::Shared ? sycl::malloc_shared<T>(count, q) : sycl::malloc_host<T>(count, q);
+}
 
-bool compareWordCounts(const pair<string, int> &a, const pair<string, int> &b) {
-    return a.second > b.second;
+
+// Same kernel as countWordOccurrences over USM pointers from
+// allocateHostVisible, without the buffer copies in and out.
+void countWordOccurrencesUSM(sycl::queue &q, UsmPlacement placement,
+                             const StringData *words, size_t numWords,
+                             const StringData *uniqueWords, size_t numUniqueWords,
+                             int *wordCounts, const std::shared_future<KernelBundle> &kernelsReady) {
+    const StringData *kernelWords = words;
+    const StringData *kernelUniqueWords = uniqueWords;
+    int *kernelCounts = wordCounts;
+    std::vector<sycl::event> uploads;
+
+    if (placement == UsmPlacement::Device) {
+        StringData *deviceWords = sycl::malloc_device<StringData>(std::max<size_t>(numWords, 1), q);
+        StringData *deviceUniqueWords = sycl::malloc_device<StringData>(std::max<size_t>(numUniqueWords, 1), q);
+        int *deviceCounts = sycl::malloc_device<int>(std::max<size_t>(numUniqueWords, 1), q);
+        uploads.push_back(q.memcpy(deviceWords, words, numWords * sizeof(StringData)));
+        uploads.push_back(q.memcpy(deviceUniqueWords, uniqueWords, numUniqueWords * sizeof(StringData)));
+        uploads.push_back(q.memset(deviceCounts, 0, numUniqueWords * sizeof(int)));
+        kernelWords = deviceWords;
+        kernelUniqueWords = deviceUniqueWords;
+        kernelCounts = deviceCounts;
+    } else {
+        std::fill(wordCounts, wordCounts + numUniqueWords, 0);
+    }
+
+    submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(uploads);
+        h.parallel_for(sycl::range<1>(numWords), [=](sycl::id<1> i) {
+            const StringData &word = kernelWords[i];
+            for (size_t j = 0; j < numUniqueWords; ++j) {
+                if (kernelUniqueWords[j] == word) {
+                    sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> atomicCounter(kernelCounts[j]);
+                    atomicCounter.fetch_add(1);
+                }
+            }
+        });
+    }).wait_and_throw();
+
+    if (placement == UsmPlacement::Device) {
+        q.memcpy(wordCounts, kernelCounts, numUniqueWords * sizeof(int)).wait();
+        sycl::free(const_cast<StringData *>(kernelWords), q);
+        sycl::free(const_cast<StringData *>(kernelUniqueWords), q);
+        sycl::free(kernelCounts, q);
+    }
 }
 
 
-int main() {
-    string targetFilePath = "hamlet_manylines.txt";
-    size_t minimumWordLength = 10;
-    vector<string> targetWords = readWordsFromFile(targetFilePath, minimumWordLength);
 
-    std::vector<StringData> targetWordsData;
+// Bytes handled serially by one work-item in the scan and tokenizer kernels.
+constexpr size_t scanChunkSize = 256;
+
+// Same delimiters as istringstream >> in readWordsFromFile.
+inline bool isDelimiter(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+inline bool isLetter(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+
+// Scratch needed by exclusiveScan for n elements: one level of chunk sums per
+// recursion step.
+size_t scanScratchSize(size_t n) {
+    size_t numChunks = (n + scanChunkSize - 1) / scanChunkSize;
+    return numChunks <= 1 ? 0 : numChunks + scanScratchSize(numChunks);
+}
+
+
+// Exclusive prefix sum over a device array, in place, with the total written
+// to a device scalar. Each work-item sums one chunk, the chunk sums are scanned
+// recursively, and a second pass rewrites each chunk from its offset. Nothing
+// waits on the host, so callers can chain it with events.
+sycl::event exclusiveScan(sycl::queue &q, uint32_t *data, size_t n, uint32_t *scratch,
+                          uint32_t *total, sycl::event dependency,
+                          const std::shared_future<KernelBundle> &kernelsReady) {
+    size_t numChunks = (n + scanChunkSize - 1) / scanChunkSize;
+
+    if (numChunks <= 1) {
+        return submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+            h.depends_on(dependency);
+            h.single_task([=]() {
+                uint32_t running = 0;
+                for (size_t i = 0; i < n; i++) {
+                    uint32_t value = data[i];
+                    data[i] = running;
+                    running += value;
+                }
+                *total = running;
+            });
+        });
+    }
+
+    uint32_t *sums = scratch;
+    sycl::event summed = submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(dependency);
+        h.parallel_for(sycl::range<1>(numChunks), [=](sycl::id<1> c) {
+            size_t begin = c * scanChunkSize;
+            size_t end = std::min(n, begin + scanChunkSize);
+            uint32_t sum = 0;
+            for (size_t i = begin; i < end; i++) {
+                sum += data[i];
+            }
+            sums[c] = sum;
+        });
+    });
+
+    sycl::event scanned = exclusiveScan(q, sums, numChunks, scratch + numChunks, total, summed, kernelsReady);
+
+    return submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(scanned);
+        h.parallel_for(sycl::range<1>(numChunks), [=](sycl::id<1> c) {
+            size_t begin = c * scanChunkSize;
+            size_t end = std::min(n, begin + scanChunkSize);
+            uint32_t running = sums[c];
+            for (size_t i = begin; i < end; i++) {
+                uint32_t value = data[i];
+                data[i] = running;
+                running += value;
+            }
+        });
+    });
+}
+
+
+// Device buffers for tokenizing one chunk of up to maxBytes bytes. After
+// tokenizeChunk, token t is folded[starts[t], starts[t] + lengths[t]) for
+// t < *tokenCount; tokens rejected by the filters in readWordsFromFile keep
+// their id but have length 0. tokenBound bounds *tokenCount from the size of
+// the chunk last tokenized, so per-token kernels launch that many work-items
+// instead of maxTokens and the count never has to be read back.
+struct TokenizerBuffers {
+    size_t maxBytes;
+    size_t maxTokens;
+    size_t tokenBound;
+    char *raw;
+    char *folded;
+    uint32_t *chunkTokens;
+    uint32_t *scanScratch;
+    uint32_t *starts;
+    uint32_t *lengths;
+    uint32_t *tokenSlots;
+    uint32_t *tokenCount;
+};
+
+
+TokenizerBuffers allocateTokenizer(sycl::queue &q, size_t maxBytes) {
+    TokenizerBuffers buffers;
+    size_t numChunks = (maxBytes + scanChunkSize - 1) / scanChunkSize;
+    buffers.maxBytes = maxBytes;
+    // Every token is followed by a delimiter or the end of the chunk.
+    buffers.maxTokens = maxBytes / 2 + 1;
+    buffers.tokenBound = 0;
+    buffers.raw = sycl::malloc_device<char>(maxBytes, q);
+    buffers.folded = sycl::malloc_device<char>(maxBytes, q);
+    buffers.chunkTokens = sycl::malloc_device<uint32_t>(numChunks, q);
+    buffers.scanScratch = sycl::malloc_device<uint32_t>(std::max<size_t>(scanScratchSize(numChunks), 1), q);
+    buffers.starts = sycl::malloc_device<uint32_t>(buffers.maxTokens, q);
+    buffers.lengths = sycl::malloc_device<uint32_t>(buffers.maxTokens, q);
+    buffers.tokenSlots = sycl::malloc_device<uint32_t>(buffers.maxTokens, q);
+    buffers.tokenCount = sycl::malloc_device<uint32_t>(1, q);
+    return buffers;
+}
+
+
+void freeTokenizer(sycl::queue &q, TokenizerBuffers &buffers) {
+    sycl::free(buffers.raw, q);
+    sycl::free(buffers.folded, q);
+    sycl::free(buffers.chunkTokens, q);
+    sycl::free(buffers.scanScratch, q);
+    sycl::free(buffers.starts, q);
+    sycl::free(buffers.lengths, q);
+    sycl::free(buffers.tokenSlots, q);
+    sycl::free(buffers.tokenCount, q);
+}
+
+
+// Tokenizes the n bytes already in buffers.raw. The classify kernel upper-cases
+// each chunk and counts token starts (a non-delimiter after a delimiter); an
+// exclusive scan over those counts gives each chunk its first token id, and the
+// emit kernel writes every token's offset and length.
+sycl::event tokenizeChunk(sycl::queue &q, TokenizerBuffers &buffers, size_t n, size_t minimumWordLength,
+                          sycl::event dependency, const std::shared_future<KernelBundle> &kernelsReady) {
+    size_t numChunks = std::max<size_t>((n + scanChunkSize - 1) / scanChunkSize, 1);
+    buffers.tokenBound = n / 2 + 1;
+    const char *raw = buffers.raw;
+    char *folded = buffers.folded;
+    uint32_t *chunkTokens = buffers.chunkTokens;
+    uint32_t *starts = buffers.starts;
+    uint32_t *lengths = buffers.lengths;
+
+    sycl::event classified = submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(dependency);
+        h.parallel_for(sycl::range<1>(numChunks), [=](sycl::id<1> c) {
+            size_t begin = c * scanChunkSize;
+            size_t end = std::min(n, begin + scanChunkSize);
+            uint32_t tokenStarts = 0;
+            for (size_t i = begin; i < end; i++) {
+                char ch = raw[i];
+                folded[i] = (ch >= 'a' && ch <= 'z') ? static_cast<char>(ch - 'a' + 'A') : ch;
+                if (!isDelimiter(ch) && (i == 0 || isDelimiter(raw[i - 1]))) {
+                    tokenStarts++;
+                }
+            }
+            chunkTokens[c] = tokenStarts;
+        });
+    });
+
+    sycl::event scanned = exclusiveScan(q, chunkTokens, numChunks, buffers.scanScratch, buffers.tokenCount, classified,
+                                          kernelsReady);
+
+    return submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(scanned);
+        h.parallel_for(sycl::range<1>(numChunks), [=](sycl::id<1> c) {
+            size_t begin = c * scanChunkSize;
+            size_t end = std::min(n, begin + scanChunkSize);
+            uint32_t tokenId = chunkTokens[c];
+            for (size_t i = begin; i < end; i++) {
+                if (isDelimiter(raw[i]) || (i > 0 && !isDelimiter(raw[i - 1]))) {
+                    continue;
+                }
+                size_t j = i;
+                bool allLetters = true;
+                while (j < n && !isDelimiter(raw[j])) {
+                    allLetters = allLetters && isLetter(raw[j]);
+                    j++;
+                }
+                starts[tokenId] = static_cast<uint32_t>(i);
+                lengths[tokenId] = (allLetters && j - i >= minimumWordLength) ? static_cast<uint32_t>(j - i) : 0;
+                tokenId++;
+            }
+        });
+    });
+}
+
+
+// Open-addressing count table in device memory. Slots are claimed by a 64-bit
+// FNV-1a hash with compare-exchange (0 marks an empty slot), but a token is
+// only counted in a slot once its bytes match the slot's key, so words that
+// share a hash are never merged. Each slot keeps the smallest global token id
+// that hashed to it; that token copies its bytes into the key pool and becomes
+// the slot's key, so the table outlives the chunks it was built from and
+// words of any length come back whole.
+//
+// A token whose hash matches a slot holding a different word is a true 64-bit
+// collision. Those are vanishingly rare, so instead of probing on they are
+// copied to the pool and listed as spills, which readCountTable counts on the
+// host.
+struct DeviceCountTable {
+    size_t capacity;
+    uint64_t *keys;
+    uint32_t *counts;
+    uint64_t *representatives;
+    uint32_t *keyOffsets;
+    uint32_t *keyLengths;
+    size_t poolBytes;
+    char *pool;
+    uint32_t *poolUsed;
+    size_t maxSpills;
+    uint32_t *spillOffsets;
+    uint32_t *spillLengths;
+    uint32_t *spillCount;
+    uint32_t *overflow;
+};
+
+// Key bytes reserved per slot; English words average well under this.
+constexpr size_t keyPoolBytesPerSlot = 16;
+// Spill entries reserved per table; only true hash collisions use them.
+constexpr size_t maxHashSpills = 1 << 16;
+
+
+DeviceCountTable allocateCountTable(sycl::queue &q, size_t minimumSlots) {
+    DeviceCountTable table;
+    table.capacity = 16;
+    while (table.capacity < minimumSlots) {
+        table.capacity *= 2;
+    }
+    // Pool offsets are 32-bit.
+    table.poolBytes = std::min<size_t>(table.capacity * keyPoolBytesPerSlot, UINT32_MAX);
+    table.maxSpills = maxHashSpills;
+
+    table.keys = sycl::malloc_device<uint64_t>(table.capacity, q);
+    table.counts = sycl::malloc_device<uint32_t>(table.capacity, q);
+    table.representatives = sycl::malloc_device<uint64_t>(table.capacity, q);
+    table.keyOffsets = sycl::malloc_device<uint32_t>(table.capacity, q);
+    table.keyLengths = sycl::malloc_device<uint32_t>(table.capacity, q);
+    table.pool = sycl::malloc_device<char>(table.poolBytes, q);
+    table.poolUsed = sycl::malloc_device<uint32_t>(1, q);
+    table.spillOffsets = sycl::malloc_device<uint32_t>(table.maxSpills, q);
+    table.spillLengths = sycl::malloc_device<uint32_t>(table.maxSpills, q);
+    table.spillCount = sycl::malloc_device<uint32_t>(1, q);
+    table.overflow = sycl::malloc_device<uint32_t>(1, q);
+    q.memset(table.keys, 0, table.capacity * sizeof(uint64_t));
+    q.memset(table.counts, 0, table.capacity * sizeof(uint32_t));
+    q.fill(table.representatives, UINT64_MAX, table.capacity);
+    q.memset(table.keyLengths, 0, table.capacity * sizeof(uint32_t));
+    q.memset(table.poolUsed, 0, sizeof(uint32_t));
+    q.memset(table.spillCount, 0, sizeof(uint32_t));
+    q.memset(table.overflow, 0, sizeof(uint32_t));
+    q.wait();
+    return table;
+}
+
+
+void freeCountTable(sycl::queue &q, DeviceCountTable &table) {
+    sycl::free(table.keys, q);
+    sycl::free(table.counts, q);
+    sycl::free(table.representatives, q);
+    sycl::free(table.keyOffsets, q);
+    sycl::free(table.keyLengths, q);
+    sycl::free(table.pool, q);
+    sycl::free(table.poolUsed, q);
+    sycl::free(table.spillOffsets, q);
+    sycl::free(table.spillLengths, q);
+    sycl::free(table.spillCount, q);
+    sycl::free(table.overflow, q);
+}
+
+
+// Copies length bytes into the table's key pool and returns their offset, or
+// UINT32_MAX (with the overflow flag set) when the pool is full.
+inline uint32_t copyToPool(char *pool, uint32_t *poolUsed, size_t poolBytes, uint32_t *overflow,
+                           const char *bytes, uint32_t length) {
+    sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> used(*poolUsed);
+    uint32_t offset = used.fetch_add(length);
+    if (static_cast<size_t>(offset) + length > poolBytes) {
+        sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> full(*overflow);
+        full.store(1);
+        return UINT32_MAX;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        pool[offset + i] = bytes[i];
+    }
+    return offset;
+}
+
+
+// Adds one tokenized chunk to the table. tokenBase makes token ids unique
+// across chunks and increasing in corpus order. Three kernels: claim a slot
+// per token, let each new slot's representative publish its key, then count
+// every token whose bytes match its slot's key.
+sycl::event countChunk(sycl::queue &q, DeviceCountTable &table, TokenizerBuffers &buffers, uint64_t tokenBase,
+                       const std::vector<sycl::event> &dependencies,
+                       const std::shared_future<KernelBundle> &kernelsReady) {
+    const char *bytes = buffers.folded;
+    const uint32_t *starts = buffers.starts;
+    const uint32_t *lengths = buffers.lengths;
+    const uint32_t *tokenCount = buffers.tokenCount;
+    uint32_t *tokenSlots = buffers.tokenSlots;
+    uint64_t *keys = table.keys;
+    uint32_t *counts = table.counts;
+    uint64_t *representatives = table.representatives;
+    uint32_t *keyOffsets = table.keyOffsets;
+    uint32_t *keyLengths = table.keyLengths;
+    char *pool = table.pool;
+    uint32_t *poolUsed = table.poolUsed;
+    size_t poolBytes = table.poolBytes;
+    uint32_t *spillOffsets = table.spillOffsets;
+    uint32_t *spillLengths = table.spillLengths;
+    uint32_t *spillCount = table.spillCount;
+    size_t maxSpills = table.maxSpills;
+    uint32_t *overflow = table.overflow;
+    size_t capacity = table.capacity;
+    size_t mask = capacity - 1;
+
+    sycl::event claimed = submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(dependencies);
+        h.parallel_for(sycl::range<1>(buffers.tokenBound), [=](sycl::id<1> t) {
+            if (t >= *tokenCount || lengths[t] == 0) {
+                return;
+            }
+            uint64_t hash = fnv1a64(bytes + starts[t], lengths[t]);
+            hash = hash == 0 ? 1 : hash;
+
+            size_t slot = hash & mask;
+            for (size_t probes = 0;; probes++) {
+                if (probes == capacity) {
+                    sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> full(*overflow);
+                    full.store(1);
+                    tokenSlots[t] = UINT32_MAX;
+                    return;
+                }
+                sycl::atomic_ref<uint64_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> key(keys[slot]);
+                uint64_t expected = 0;
+                if (key.compare_exchange_strong(expected, hash) || expected == hash) {
+                    break;
+                }
+                slot = (slot + 1) & mask;
+            }
+
+            sycl::atomic_ref<uint64_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> representative(representatives[slot]);
+            representative.fetch_min(tokenBase + t);
+            tokenSlots[t] = static_cast<uint32_t>(slot);
+        });
+    });
+
+    sycl::event published = submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(claimed);
+        h.parallel_for(sycl::range<1>(buffers.tokenBound), [=](sycl::id<1> t) {
+            if (t >= *tokenCount || lengths[t] == 0 || tokenSlots[t] == UINT32_MAX) {
+                return;
+            }
+            uint32_t slot = tokenSlots[t];
+            if (representatives[slot] != tokenBase + t) {
+                return;
+            }
+            uint32_t offset = copyToPool(pool, poolUsed, poolBytes, overflow, bytes + starts[t], lengths[t]);
+            if (offset != UINT32_MAX) {
+                keyOffsets[slot] = offset;
+                keyLengths[slot] = lengths[t];
+            }
+        });
+    });
+
+    return submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(published);
+        h.parallel_for(sycl::range<1>(buffers.tokenBound), [=](sycl::id<1> t) {
+            if (t >= *tokenCount || lengths[t] == 0 || tokenSlots[t] == UINT32_MAX) {
+                return;
+            }
+            uint32_t slot = tokenSlots[t];
+            uint32_t length = lengths[t];
+            const char *word = bytes + starts[t];
+            bool same = keyLengths[slot] == length;
+            for (uint32_t i = 0; same && i < length; i++) {
+                same = pool[keyOffsets[slot] + i] == word[i];
+            }
+
+            if (same) {
+                sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> count(counts[slot]);
+                count.fetch_add(1);
+                return;
+            }
+            sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> spills(*spillCount);
+            uint32_t spill = spills.fetch_add(1);
+            uint32_t offset = spill < maxSpills ? copyToPool(pool, poolUsed, poolBytes, overflow, word, length) : UINT32_MAX;
+            if (offset == UINT32_MAX) {
+                sycl::atomic_ref<uint32_t, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> full(*overflow);
+                full.store(1);
+                return;
+            }
+            spillOffsets[spill] = offset;
+            spillLengths[spill] = length;
+        });
+    });
+}
+
+
+vector<pair<string, int>> readCountTable(sycl::queue &q, const DeviceCountTable &table) {
+    vector<uint32_t> hostCounts(table.capacity);
+    vector<uint32_t> hostOffsets(table.capacity);
+    vector<uint32_t> hostLengths(table.capacity);
+    uint32_t poolUsed = 0;
+    uint32_t spillCount = 0;
+    uint32_t overflow = 0;
+    q.memcpy(hostCounts.data(), table.counts, table.capacity * sizeof(uint32_t));
+    q.memcpy(hostOffsets.data(), table.keyOffsets, table.capacity * sizeof(uint32_t));
+    q.memcpy(hostLengths.data(), table.keyLengths, table.capacity * sizeof(uint32_t));
+    q.memcpy(&poolUsed, table.poolUsed, sizeof(uint32_t));
+    q.memcpy(&spillCount, table.spillCount, sizeof(uint32_t));
+    q.memcpy(&overflow, table.overflow, sizeof(uint32_t));
+    q.wait();
+
+    // Thrown rather than exiting, since the NUMA split reads its tables on
+    // async worker threads; the future hands the error to main.
+    if (overflow) {
+        throw std::runtime_error("Count table is full; rerun with a larger --tableSlots.");
+    }
+
+    vector<char> hostPool(poolUsed);
+    vector<uint32_t> spillOffsets(spillCount);
+    vector<uint32_t> spillLengths(spillCount);
+    q.memcpy(hostPool.data(), table.pool, poolUsed);
+    q.memcpy(spillOffsets.data(), table.spillOffsets, spillCount * sizeof(uint32_t));
+    q.memcpy(spillLengths.data(), table.spillLengths, spillCount * sizeof(uint32_t));
+    q.wait();
+
+    vector<pair<string, int>> wordCountPairs;
+    for (size_t slot = 0; slot < table.capacity; slot++) {
+        if (hostCounts[slot] > 0) {
+            wordCountPairs.emplace_back(string(hostPool.data() + hostOffsets[slot], hostLengths[slot]),
+                                        static_cast<int>(hostCounts[slot]));
+        }
+    }
+
+    FlatMap::FlatWordMap<int> spilled;
+    for (uint32_t spill = 0; spill < spillCount; spill++) {
+        spilled[string_view(hostPool.data() + spillOffsets[spill], spillLengths[spill])]++;
+    }
+    vector<pair<string, int>> spilledPairs = mapToVector(spilled);
+    wordCountPairs.insert(wordCountPairs.end(), spilledPairs.begin(), spilledPairs.end());
+    return wordCountPairs;
+}
+
+
+// Streams the corpus through the device in fixed-size chunks using two sets of
+// pinned host staging and device buffers. While the device uploads chunk i and
+// counts chunk i - 1, the host is already reading chunk i + 1; event
+// dependencies order the stages, so memory stays bounded by the chunk size
+// and the count table however large the file is. Only bytes [begin, end) of
+// the file are counted; nextTokenBase is advanced past every token id used.
+void streamCorpusIntoTable(sycl::queue &q, DeviceCountTable &table, const string &path, size_t minimumWordLength,
+                           size_t chunkBytes, uint64_t &nextTokenBase, size_t begin = 0, size_t end = SIZE_MAX,
+                           const std::shared_future<KernelBundle> &kernelsReady = {}) {
+    ifstream inputFile(path, ios::binary);
+    if (!inputFile.is_open()) {
+        throw std::runtime_error("Could not open file '" + path + "'.");
+    }
+    inputFile.seekg(begin);
+    size_t remaining = end - begin;
+
+    char *staging[2];
+    TokenizerBuffers buffers[2];
+    sycl::event uploaded[2];
+    sycl::event counted[2];
+    for (int slot = 0; slot < 2; slot++) {
+        staging[slot] = sycl::malloc_host<char>(chunkBytes, q);
+        buffers[slot] = allocateTokenizer(q, chunkBytes);
+    }
+
+    // A token cut by the chunk boundary is carried into the next chunk.
+    string carry;
+    sycl::event lastCounted;
+    for (uint64_t chunk = 0;; chunk++) {
+        int slot = chunk % 2;
+        uploaded[slot].wait();
+
+        size_t length = carry.size();
+        memcpy(staging[slot], carry.data(), length);
+        inputFile.read(staging[slot] + length, std::min(chunkBytes - length, remaining));
+        length += inputFile.gcount();
+        remaining -= inputFile.gcount();
+        if (length == 0) {
+            break;
+        }
+
+        size_t cut = length;
+        if (inputFile && remaining > 0) {
+            while (cut > 0 && !isDelimiter(staging[slot][cut - 1])) {
+                cut--;
+            }
+            // A single token longer than a chunk is split rather than stalling.
+            if (cut == 0) {
+                cut = length;
+            }
+        }
+        carry.assign(staging[slot] + cut, length - cut);
+
+        uploaded[slot] = q.memcpy(buffers[slot].raw, staging[slot], cut, counted[slot]);
+        sycl::event tokenized = tokenizeChunk(q, buffers[slot], cut, minimumWordLength, uploaded[slot], kernelsReady);
+        counted[slot] = countChunk(q, table, buffers[slot], nextTokenBase, {tokenized, lastCounted}, kernelsReady);
+        lastCounted = counted[slot];
+        nextTokenBase += buffers[slot].tokenBound;
+    }
+
+    q.wait_and_throw();
+
+    for (int slot = 0; slot < 2; slot++) {
+        sycl::free(staging[slot], q);
+        freeTokenizer(q, buffers[slot]);
+    }
+}
+
+
+vector<pair<string, int>> countCorpusStreaming(sycl::queue &q, const string &path, size_t minimumWordLength,
+                                               size_t chunkBytes, size_t tableSlots,
+                                               size_t begin = 0, size_t end = SIZE_MAX) {
+    DeviceCountTable table = allocateCountTable(q, tableSlots);
+    uint64_t nextTokenBase = 0;
+    vector<pair<string, int>> wordCountPairs;
+    try {
+        streamCorpusIntoTable(q, table, path, minimumWordLength, chunkBytes, nextTokenBase, begin, end);
+        wordCountPairs = readCountTable(q, table);
+    } catch (...) {
+        freeCountTable(q, table);
+        throw;
+    }
+    freeCountTable(q, table);
+    return wordCountPairs;
+}
+
+
+// The device count table behind the CountingEngine interface. ingestFile()
+// streams a corpus through the device tokenizer; ingest() joins host tokens
+// with newlines and pushes them through the same tokenizer in chunk-sized
+// batches, so both feed one persistent table.
+class SyclHashTableEngine : public CountingEngines::CountingEngine {
+public:
+    SyclHashTableEngine(sycl::queue &q, size_t chunkBytes, size_t tableSlots,
+                        std::shared_future<KernelBundle> kernelsReady = {})
+        : q(q)
+        , chunkBytes(chunkBytes)
+        , table(allocateCountTable(q, tableSlots))
+        , nextTokenBase(0)
+        , kernelsReady(kernelsReady) {
+    }
+
+    ~SyclHashTableEngine() override {
+        freeCountTable(q, table);
+    }
+
+    SyclHashTableEngine(const SyclHashTableEngine &) = delete;
+    SyclHashTableEngine &operator=(const SyclHashTableEngine &) = delete;
+
+    const char *name() const override { return "sycl"; }
+
+    void ingest(const vector<string_view> &tokens) override {
+        string batch;
+        for (size_t i = 0; i < tokens.size(); i++) {
+            batch += tokens[i];
+            batch += '\n';
+            if (batch.size() >= chunkBytes || i + 1 == tokens.size()) {
+                countBatch(batch);
+                batch.clear();
+            }
+        }
+    }
+
+    bool ingestFile(const string &path, size_t minimumWordLength) override {
+        streamCorpusIntoTable(q, table, path, minimumWordLength, chunkBytes, nextTokenBase, 0, SIZE_MAX, kernelsReady);
+        return true;
+    }
+
+    void finish() override {
+        q.wait_and_throw();
+        wordCountPairs = readCountTable(q, table);
+    }
+
+    vector<pair<string, int>> results() const override {
+        return wordCountPairs;
+    }
+
+private:
+    sycl::queue &q;
+    size_t chunkBytes;
+    DeviceCountTable table;
+    uint64_t nextTokenBase;
+    std::shared_future<KernelBundle> kernelsReady;
+    vector<pair<string, int>> wordCountPairs;
+
+    void countBatch(const string &batch) {
+        TokenizerBuffers buffers = allocateTokenizer(q, batch.size());
+        sycl::event uploaded = q.memcpy(buffers.raw, batch.data(), batch.size());
+        sycl::event tokenized = tokenizeChunk(q, buffers, batch.size(), 1, uploaded, kernelsReady);
+        countChunk(q, table, buffers, nextTokenBase, {tokenized}, kernelsReady).wait_and_throw();
+        nextTokenBase += buffers.tokenBound;
+        freeTokenizer(q, buffers);
+    }
+};
+
+
+// Original path: tokenize on the host and ship StringData records to the device,
+// through sycl::buffer copies or, with useUsm, the USM variant.
+vector<pair<string, int>> countHostTokenized(sycl::queue &q, const string &path, size_t minimumWordLength,
+                                             bool useUsm, UsmPlacement placement,
+                                             const std::shared_future<KernelBundle> &kernelsReady = {}) {
+    WordLoader::LoadedWords loaded = readWordsFromFile(path, minimumWordLength);
+    const vector<string_view> &targetWords = loaded.tokens;
+    std::unordered_set<std::string_view> wordSet(targetWords.begin(), targetWords.end());
+    std::vector<std::pair<std::string, int>> wordCountPairs;
+    wordCountPairs.reserve(wordSet.size());
+
+    if (useUsm) {
+        StringData *targetWordsData = allocateHostVisible<StringData>(q, placement, targetWords.size());
+        StringData *uniqueWordsData = allocateHostVisible<StringData>(q, placement, wordSet.size());
+        int *wordCounts = allocateHostVisible<int>(q, placement, wordSet.size());
+        for (size_t i = 0; i < targetWords.size(); ++i) {
+            targetWordsData[i] = StringData(targetWords[i]);
+        }
+        size_t numUniqueWords = 0;
+        for (const auto &word : wordSet) {
+            uniqueWordsData[numUniqueWords++] = StringData(word);
+        }
+
+        countWordOccurrencesUSM(q, placement, targetWordsData, targetWords.size(),
+                                uniqueWordsData, numUniqueWords, wordCounts, kernelsReady);
+
+        for (size_t i = 0; i < numUniqueWords; ++i) {
+            wordCountPairs.emplace_back(std::string(uniqueWordsData[i].data), wordCounts[i]);
+        }
+        sycl::free(targetWordsData, q);
+        sycl::free(uniqueWordsData, q);
+        sycl::free(wordCounts, q);
+        return wordCountPairs;
+    }
+
+    HostVector<StringData> targetWordsData;
     targetWordsData.reserve(targetWords.size());
     for (const auto &word : targetWords) {
         targetWordsData.push_back(StringData(word));
     }
 
-    std::unordered_set<std::string> wordSet(targetWords.begin(), targetWords.end());
-    std::vector<StringData> uniqueWordsData;
+    HostVector<StringData> uniqueWordsData;
     uniqueWordsData.reserve(wordSet.size());
     for (const auto &word : wordSet) {
         uniqueWordsData.push_back(StringData(word));
     }
 
-    std::vector<int> wordCounts(uniqueWordsData.size());
+    HostVector<int> wordCounts(uniqueWordsData.size());
+    HugePages::report(cerr);
 
-    try {
-        std::string vendor_name = "Intel";
-        // std::string vendor_name = "AMD";
-        // std::string vendor_name = "Nvidia";
-        CustomDeviceSelector selector(vendor_name);
-        sycl::queue q(selector);
-        countWordOccurrences(q, targetWordsData, uniqueWordsData, wordCounts);
-    } catch (...) {
-        std::cout << "Failure" << "\n";
-        std::terminate();
-    }
-    
+    countWordOccurrences(q, targetWordsData, uniqueWordsData, wordCounts, kernelsReady);
 
-    std::vector<std::pair<std::string, int>> wordCountPairs(uniqueWordsData.size());
     for (size_t i = 0; i < uniqueWordsData.size(); ++i) {
-        wordCountPairs[i] = std::make_pair(std::string(uniqueWordsData[i].data), wordCounts[i]);
+        wordCountPairs.emplace_back(std::string(uniqueWordsData[i].data), wordCounts[i]);
+    }
+    return wordCountPairs;
+}
+
+
+// A token of up to 8 * Words bytes packed into machine words and zero-padded.
+// Short words hash and compare as one or two integers instead of a 32-byte
+// StringData record.
+template <size_t Words>
+struct PackedKey {
+    uint64_t words[Words] = {};
+
+    static PackedKey pack(string_view word) {
+        PackedKey key;
+        std::memcpy(key.words, word.data(), std::min(word.size(), sizeof(key.words)));
+        return key;
+    }
+
+    string unpack() const {
+        char bytes[sizeof(words)];
+        std::memcpy(bytes, words, sizeof(words));
+        return string(bytes, strnlen(bytes, sizeof(bytes)));
+    }
+
+    uint64_t hash() const {
+        uint64_t hash = 0;
+        for (size_t i = 0; i < Words; i++) {
+            hash = (hash ^ words[i]) * 0x9e3779b97f4a7c15ull;
+        }
+        return hash ^ (hash >> 29);
+    }
+
+    bool operator==(const PackedKey &other) const {
+        uint64_t difference = 0;
+        for (size_t i = 0; i < Words; i++) {
+            difference |= words[i] ^ other.words[i];
+        }
+        return difference == 0;
+    }
+};
+
+// Tokens split by length class: up to 8, 16 and 32 bytes in one, two and four
+// machine words, and the long tail as views of the original tokens.
+struct BucketedTokens {
+    vector<PackedKey<1>> upTo8;
+    vector<PackedKey<2>> upTo16;
+    vector<PackedKey<4>> upTo32;
+    vector<string_view> longer;
+};
+
+template <typename Container>
+BucketedTokens bucketTokens(const Container &tokens) {
+    BucketedTokens buckets;
+    for (const auto &word : tokens) {
+        if (word.size() <= 8) {
+            buckets.upTo8.push_back(PackedKey<1>::pack(word));
+        } else if (word.size() <= 16) {
+            buckets.upTo16.push_back(PackedKey<2>::pack(word));
+        } else if (word.size() <= 32) {
+            buckets.upTo32.push_back(PackedKey<4>::pack(word));
+        } else {
+            buckets.longer.push_back(word);
+        }
+    }
+    return buckets;
+}
+
+// Counts one length class on the device. The host lays uniqueKeys out in an
+// open-addressing slot array; each work-item probes it with its token's key,
+// so a lookup costs a hash and a few word compares rather than a scan over
+// every unique word.
+template <size_t Words>
+void countLengthClass(sycl::queue &q, const vector<PackedKey<Words>> &tokens,
+                      const vector<PackedKey<Words>> &uniqueKeys, vector<pair<string, int>> &wordCountPairs,
+                      const std::shared_future<KernelBundle> &kernelsReady) {
+    if (tokens.empty()) {
+        return;
+    }
+
+    size_t capacity = 16;
+    while (capacity < 2 * uniqueKeys.size()) {
+        capacity *= 2;
+    }
+    size_t mask = capacity - 1;
+    vector<uint32_t> hostSlots(capacity, UINT32_MAX);
+    for (uint32_t i = 0; i < uniqueKeys.size(); i++) {
+        size_t slot = uniqueKeys[i].hash() & mask;
+        while (hostSlots[slot] != UINT32_MAX) {
+            slot = (slot + 1) & mask;
+        }
+        hostSlots[slot] = i;
+    }
+
+    PackedKey<Words> *deviceTokens = sycl::malloc_device<PackedKey<Words>>(tokens.size(), q);
+    PackedKey<Words> *deviceKeys = sycl::malloc_device<PackedKey<Words>>(uniqueKeys.size(), q);
+    uint32_t *slots = sycl::malloc_device<uint32_t>(capacity, q);
+    int *counts = sycl::malloc_device<int>(uniqueKeys.size(), q);
+    std::vector<sycl::event> uploads;
+    uploads.push_back(q.memcpy(deviceTokens, tokens.data(), tokens.size() * sizeof(PackedKey<Words>)));
+    uploads.push_back(q.memcpy(deviceKeys, uniqueKeys.data(), uniqueKeys.size() * sizeof(PackedKey<Words>)));
+    uploads.push_back(q.memcpy(slots, hostSlots.data(), capacity * sizeof(uint32_t)));
+    uploads.push_back(q.memset(counts, 0, uniqueKeys.size() * sizeof(int)));
+
+    submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(uploads);
+        h.parallel_for(sycl::range<1>(tokens.size()), [=](sycl::id<1> t) {
+            const PackedKey<Words> &key = deviceTokens[t];
+            size_t slot = key.hash() & mask;
+            while (slots[slot] != UINT32_MAX) {
+                if (deviceKeys[slots[slot]] == key) {
+                    sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> count(counts[slots[slot]]);
+                    count.fetch_add(1);
+                    return;
+                }
+                slot = (slot + 1) & mask;
+            }
+        });
+    }).wait_and_throw();
+
+    vector<int> hostCounts(uniqueKeys.size());
+    q.memcpy(hostCounts.data(), counts, uniqueKeys.size() * sizeof(int)).wait();
+    for (size_t i = 0; i < uniqueKeys.size(); i++) {
+        wordCountPairs.emplace_back(uniqueKeys[i].unpack(), hostCounts[i]);
+    }
+
+    sycl::free(deviceTokens, q);
+    sycl::free(deviceKeys, q);
+    sycl::free(slots, q);
+    sycl::free(counts, q);
+}
+
+// Counts the tokens longer than 32 bytes. Same slot array as
+// countLengthClass, sized to this class's unique words, but keys are
+// variable-length: every word is copied into one byte pool and a probe
+// compares lengths and then bytes, so words are kept whole and never merged.
+void countLongClass(sycl::queue &q, const vector<string_view> &tokens, const vector<string_view> &uniqueWords,
+                    vector<pair<string, int>> &wordCountPairs,
+                    const std::shared_future<KernelBundle> &kernelsReady) {
+    if (tokens.empty()) {
+        return;
+    }
+
+    size_t capacity = 16;
+    while (capacity < 2 * uniqueWords.size()) {
+        capacity *= 2;
+    }
+    size_t mask = capacity - 1;
+
+    // Unique words first, then tokens, each as (offset, length) into the pool.
+    vector<char> hostPool;
+    vector<uint32_t> hostOffsets;
+    vector<uint32_t> hostLengths;
+    auto append = [&](string_view word) {
+        hostOffsets.push_back(static_cast<uint32_t>(hostPool.size()));
+        hostLengths.push_back(static_cast<uint32_t>(word.size()));
+        hostPool.insert(hostPool.end(), word.begin(), word.end());
+    };
+    for (string_view word : uniqueWords) {
+        append(word);
+    }
+    for (string_view word : tokens) {
+        append(word);
+    }
+    if (hostPool.size() > UINT32_MAX) {
+        throw std::runtime_error("Words longer than 32 bytes take up more than 4 GB.");
+    }
+
+    vector<uint32_t> hostSlots(capacity, UINT32_MAX);
+    for (uint32_t i = 0; i < uniqueWords.size(); i++) {
+        size_t slot = fnv1a64(uniqueWords[i].data(), static_cast<uint32_t>(uniqueWords[i].size())) & mask;
+        while (hostSlots[slot] != UINT32_MAX) {
+            slot = (slot + 1) & mask;
+        }
+        hostSlots[slot] = i;
+    }
+
+    size_t numUnique = uniqueWords.size();
+    char *pool = sycl::malloc_device<char>(hostPool.size(), q);
+    uint32_t *offsets = sycl::malloc_device<uint32_t>(hostOffsets.size(), q);
+    uint32_t *lengths = sycl::malloc_device<uint32_t>(hostLengths.size(), q);
+    uint32_t *slots = sycl::malloc_device<uint32_t>(capacity, q);
+    int *counts = sycl::malloc_device<int>(numUnique, q);
+    std::vector<sycl::event> uploads;
+    uploads.push_back(q.memcpy(pool, hostPool.data(), hostPool.size()));
+    uploads.push_back(q.memcpy(offsets, hostOffsets.data(), hostOffsets.size() * sizeof(uint32_t)));
+    uploads.push_back(q.memcpy(lengths, hostLengths.data(), hostLengths.size() * sizeof(uint32_t)));
+    uploads.push_back(q.memcpy(slots, hostSlots.data(), capacity * sizeof(uint32_t)));
+    uploads.push_back(q.memset(counts, 0, numUnique * sizeof(int)));
+
+    submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(uploads);
+        h.parallel_for(sycl::range<1>(tokens.size()), [=](sycl::id<1> t) {
+            const char *word = pool + offsets[numUnique + t];
+            uint32_t length = lengths[numUnique + t];
+            size_t slot = fnv1a64(word, length) & mask;
+            while (slots[slot] != UINT32_MAX) {
+                uint32_t key = slots[slot];
+                bool same = lengths[key] == length;
+                for (uint32_t i = 0; same && i < length; i++) {
+                    same = pool[offsets[key] + i] == word[i];
+                }
+                if (same) {
+                    sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> count(counts[key]);
+                    count.fetch_add(1);
+                    return;
+                }
+                slot = (slot + 1) & mask;
+            }
+        });
+    }).wait_and_throw();
+
+    vector<int> hostCounts(numUnique);
+    q.memcpy(hostCounts.data(), counts, numUnique * sizeof(int)).wait();
+    for (size_t i = 0; i < numUnique; i++) {
+        wordCountPairs.emplace_back(string(uniqueWords[i]), hostCounts[i]);
+    }
+
+    sycl::free(pool, q);
+    sycl::free(offsets, q);
+    sycl::free(lengths, q);
+    sycl::free(slots, q);
+    sycl::free(counts, q);
+}
+
+// Host tokenizer with length-bucketed keys: each class runs its own kernel
+// instantiation, and tokens longer than 32 bytes are counted by
+// countLongClass.
+vector<pair<string, int>> countHostBucketed(sycl::queue &q, const string &path, size_t minimumWordLength,
+                                            const std::shared_future<KernelBundle> &kernelsReady = {}) {
+    WordLoader::LoadedWords loaded = readWordsFromFile(path, minimumWordLength);
+    const vector<string_view> &targetWords = loaded.tokens;
+    std::unordered_set<std::string_view> wordSet(targetWords.begin(), targetWords.end());
+    BucketedTokens tokens = bucketTokens(targetWords);
+    BucketedTokens uniqueKeys = bucketTokens(wordSet);
+
+    std::vector<std::pair<std::string, int>> wordCountPairs;
+    wordCountPairs.reserve(wordSet.size());
+    countLengthClass(q, tokens.upTo8, uniqueKeys.upTo8, wordCountPairs, kernelsReady);
+    countLengthClass(q, tokens.upTo16, uniqueKeys.upTo16, wordCountPairs, kernelsReady);
+    countLengthClass(q, tokens.upTo32, uniqueKeys.upTo32, wordCountPairs, kernelsReady);
+    countLongClass(q, tokens.longer, uniqueKeys.longer, wordCountPairs, kernelsReady);
+    return wordCountPairs;
+}
+
+
+// Host tokenizer with dictionary encoding: only the 4-byte id stream goes to
+// the device, where counting is a dense histogram with one atomic add per
+// token. Ranking runs on the counts; strings come back for the output only.
+vector<pair<string, int>> countHostEncoded(sycl::queue &q, const string &path, size_t minimumWordLength,
+                                           size_t numThreads, bool useCache,
+                                           const std::shared_future<KernelBundle> &kernelsReady = {}) {
+    TokenCache::EncodedCorpus corpus = encodeCorpus(path, minimumWordLength, numThreads, useCache);
+    const HostVector<uint32_t> &ids = corpus.ids;
+    size_t numIds = corpus.words.size();
+
+    uint32_t *deviceIds = sycl::malloc_device<uint32_t>(std::max<size_t>(ids.size(), 1), q);
+    int *counts = sycl::malloc_device<int>(std::max<size_t>(numIds, 1), q);
+    std::vector<sycl::event> uploads;
+    uploads.push_back(q.memcpy(deviceIds, ids.data(), ids.size() * sizeof(uint32_t)));
+    uploads.push_back(q.memset(counts, 0, numIds * sizeof(int)));
+
+    submitKernel(q, kernelsReady, [&](sycl::handler &h) {
+        h.depends_on(uploads);
+        h.parallel_for(sycl::range<1>(ids.size()), [=](sycl::id<1> t) {
+            sycl::atomic_ref<int, sycl::memory_order::relaxed, sycl::memory_scope::device, sycl::access::address_space::global_space> count(counts[deviceIds[t]]);
+            count.fetch_add(1);
+        });
+    }).wait_and_throw();
+
+    vector<int> wordCounts(numIds);
+    q.memcpy(wordCounts.data(), counts, numIds * sizeof(int)).wait();
+    sycl::free(deviceIds, q);
+    sycl::free(counts, q);
+
+    return TokenDictionary::materialize(TokenDictionary::rankByCount(wordCounts, corpus.words), wordCounts, corpus.words);
+}
+
+
+// One queue per NUMA domain when the device is a CPU that can be partitioned
+// by affinity domain; otherwise just the original queue.
+vector<sycl::queue> makeNumaQueues(sycl::queue &q) {
+    sycl::device dev = q.get_device();
+    if (dev.is_cpu()) {
+        try {
+            vector<sycl::device> subDevices = dev.create_sub_devices<
+                sycl::info::partition_property::partition_by_affinity_domain>(sycl::info::partition_affinity_domain::numa);
+            if (subDevices.size() > 1) {
+                vector<sycl::queue> queues;
+                for (const auto &subDevice : subDevices) {
+                    queues.emplace_back(subDevice);
+                }
+                return queues;
+            }
+        } catch (const sycl::exception &) {
+            // Not partitionable by NUMA domain; fall through to the single queue.
+        }
+    }
+    return {q};
+}
+
+
+// Splits the file into one byte range per queue, each boundary moved forward
+// to the next delimiter so no token straddles two slices.
+vector<size_t> findSliceBoundaries(const string &path, size_t numSlices) {
+    ifstream inputFile(path, ios::binary | ios::ate);
+    if (!inputFile.is_open()) {
+        throw std::runtime_error("Could not open file '" + path + "'.");
+    }
+    size_t fileSize = inputFile.tellg();
+
+    vector<size_t> boundaries{0};
+    for (size_t i = 1; i < numSlices; i++) {
+        size_t boundary = std::max(boundaries.back(), fileSize * i / numSlices);
+        inputFile.seekg(boundary);
+        char c;
+        while (boundary < fileSize && inputFile.get(c) && !isDelimiter(c)) {
+            boundary++;
+        }
+        boundaries.push_back(boundary);
+    }
+    boundaries.push_back(fileSize);
+    return boundaries;
+}
+
+
+// Streams one slice of the corpus per NUMA sub-device, each on its own queue
+// and host thread so memory traffic stays socket-local, then merges the
+// partial tables. Each table is sized from its slice: n bytes hold at most
+// n/2 + 1 tokens, so n + 2 slots (at most tableSlots) keep probes short
+// without every domain allocating the full table. Errors in a worker reach
+// the caller through its future.
+vector<pair<string, int>> countCorpusPerNumaDomain(sycl::queue &q, const string &path, size_t minimumWordLength,
+                                                   size_t chunkBytes, size_t tableSlots) {
+    vector<sycl::queue> queues = makeNumaQueues(q);
+    cerr << "NUMA sub-devices: " << queues.size() << "\n";
+    vector<size_t> boundaries = findSliceBoundaries(path, queues.size());
+
+    vector<std::future<vector<pair<string, int>>>> partials;
+    for (size_t i = 0; i < queues.size(); i++) {
+        size_t sliceSlots = std::min(tableSlots, boundaries[i + 1] - boundaries[i] + 2);
+        partials.push_back(std::async(std::launch::async, [&, i, sliceSlots]() {
+            return countCorpusStreaming(queues[i], path, minimumWordLength, chunkBytes, sliceSlots,
+                                        boundaries[i], boundaries[i + 1]);
+        }));
+    }
+
+    FlatMap::FlatWordMap<int> wordCounts;
+    for (auto &partial : partials) {
+        for (const auto &[word, count] : partial.get()) {
+            wordCounts[word] += count;
+        }
+    }
+    return mapToVector(wordCounts);
+}
+
+
+#endif  // WC_NO_SYCL
+
+
+int main(int argc, char **argv) {
+    string targetFilePath = "hamlet_manylines.txt";
+    size_t minimumWordLength = 10;
+    string tokenizer = "device";
+    size_t chunkMegabytes = 64;
+    size_t tableSlots = 1 << 20;
+    string memory = "usm";
+    string keys = "ids";
+    bool splitNuma = false;
+    bool useCache = false;
+    string engine = "auto";
+    size_t numThreads = Numa::usableCpus();
+
+    CLI::App app{"SYCL Word Count"};
+    app.option_defaults()->always_capture_default(true);
+
+    app.add_option("-i,--input", targetFilePath, "Path to the corpus (default = hamlet_manylines.txt)");
+    app.add_option("--wordSize", minimumWordLength, "Minimum word size (default = 10)");
+    app.add_option("--engine", engine, "Counting engine: auto, serial, threads, sketch or sycl (default = auto)")
+        ->check(CLI::IsMember({"auto", "serial", "threads", "sketch", "sycl"}));
+    app.add_option("--threads", numThreads, "Worker threads for the threads engine and the id encoder (default = all CPUs)")
+        ->check(CLI::PositiveNumber);
+
+    // Options that only the sycl engine reads.
+    vector<CLI::Option *> deviceOptions;
+    deviceOptions.push_back(app.add_option("--tokenizer", tokenizer, "Tokenize on the device or the host (default = device)")
+        ->check(CLI::IsMember({"device", "host"})));
+    CLI::Option *keysOption = app.add_option("--keys", keys, "Host-tokenizer keys: dictionary ids, bucketed by length or padded StringData (default = ids)")
+        ->check(CLI::IsMember({"ids", "bucketed", "padded"}));
+    CLI::Option *memoryOption = app.add_option("--memory", memory, "Data movement for padded keys: usm or buffer (default = usm)")
+        ->check(CLI::IsMember({"usm", "buffer"}));
+    deviceOptions.push_back(keysOption);
+    deviceOptions.push_back(memoryOption);
+    deviceOptions.push_back(app.add_flag("--cache", useCache, "Reuse (or write) a tokenized cache next to the input for the id-based paths"));
+    deviceOptions.push_back(app.add_flag("--numa", splitNuma, "Split the device tokenizer path across NUMA sub-devices"));
+    CLI::Option *chunkOption = app.add_option("--chunkMB", chunkMegabytes, "Corpus chunk streamed per pipeline stage (default = 64)")
+        ->check(CLI::PositiveNumber);
+    CLI::Option *tableSlotsOption = app.add_option("--tableSlots", tableSlots, "Minimum slots in the device count table (default = 1048576)")
+        ->check(CLI::PositiveNumber);
+    deviceOptions.push_back(chunkOption);
+    deviceOptions.push_back(tableSlotsOption);
+
+    CLI11_PARSE(app, argc, argv);
+
+    // Device options pick the sycl engine under auto, and are an error with a
+    // host engine rather than being silently ignored.
+    for (const CLI::Option *option : deviceOptions) {
+        if (option->count() == 0) {
+            continue;
+        }
+        if (engine == "auto") {
+            cerr << option->get_name() << " is a sycl engine option; selecting --engine sycl" << "\n";
+            engine = "sycl";
+        } else if (engine != "sycl") {
+            cerr << "Error: " << option->get_name() << " only applies to --engine sycl." << "\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    // The same goes for options that only one sycl path reads.
+    string misplaced;
+    if (keysOption->count() > 0 && tokenizer != "host") {
+        misplaced = "--keys only applies to --tokenizer host.";
+    } else if (memoryOption->count() > 0 && (tokenizer != "host" || keys != "padded")) {
+        misplaced = "--memory only applies to --tokenizer host --keys padded.";
+    } else if (useCache && (tokenizer != "host" || keys != "ids")) {
+        misplaced = "--cache only applies to --tokenizer host --keys ids.";
+    } else if (splitNuma && tokenizer != "device") {
+        misplaced = "--numa only applies to --tokenizer device.";
+    } else if ((chunkOption->count() > 0 || tableSlotsOption->count() > 0) && tokenizer != "device") {
+        misplaced = "--chunkMB and --tableSlots only apply to --tokenizer device.";
+    }
+    if (!misplaced.empty()) {
+        cerr << "Error: " << misplaced << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::pair<std::string, int>> wordCountPairs;
+    // Set by the dictionary-encoded paths, which already rank by count.
+    bool ranked = false;
+
+    if (engine == "auto") {
+        ifstream sizeProbe(targetFilePath, ios::binary | ios::ate);
+        size_t inputBytes = sizeProbe.is_open() ? static_cast<size_t>(sizeProbe.tellg()) : 0;
+        WordLoader::LoadedWords sample = readWordsFromFile(targetFilePath, minimumWordLength, CountingEngines::smallInputBytes);
+        bool deviceAvailable = false;
+#ifndef WC_NO_SYCL
+        // Only pay for SYCL platform discovery when the input could use it.
+        if (inputBytes >= CountingEngines::deviceInputBytes) {
+            try {
+                deviceAvailable = !sycl::device::get_devices().empty();
+            } catch (...) {
+                deviceAvailable = false;
+            }
+        }
+#endif
+        size_t sampleBytes = std::min(inputBytes, CountingEngines::smallInputBytes);
+        CountingEngines::EngineProfile profile{inputBytes, CountingEngines::estimateDistinct(sample.tokens, sampleBytes, inputBytes),
+                                               deviceAvailable};
+        engine = CountingEngines::chooseEngine(profile);
+    }
+    cerr << "counting engine: " << engine << "\n";
+
+    if (engine != "sycl") {
+        unique_ptr<CountingEngines::CountingEngine> counter;
+        if (engine == "threads") {
+            counter = make_unique<CountingEngines::ThreadedEngine>(numThreads);
+        } else {
+            counter = CountingEngines::makeHostEngine(engine);
+        }
+        // Host engines copy what they keep, so the corpus is fed in bounded
+        // batches rather than loaded whole; that is what lets the sketch,
+        // picked for inputs too large to count exactly, run in fixed memory.
+        if (!counter->ingestFile(targetFilePath, minimumWordLength)) {
+            readWordBatches(targetFilePath, minimumWordLength, hostBatchBytes, SIZE_MAX,
+                            [&](WordLoader::LoadedWords &batch) { counter->ingest(batch.tokens); });
+        }
+        counter->finish();
+        wordCountPairs = counter->results();
+    } else {
+#ifdef WC_NO_SYCL
+        cerr << "Error: Built with WC_NO_SYCL; the sycl engine is not available." << "\n";
+        exit(EXIT_FAILURE);
+#else
+        try {
+            std::string vendor_name = "Intel";
+            // std::string vendor_name = "AMD";
+            // std::string vendor_name = "Nvidia";
+            CustomDeviceSelector selector(vendor_name);
+            sycl::queue q(selector);
+            UsmPlacement placement = chooseUsmPlacement(q.get_device());
+            cerr << "USM placement: " << (placement == UsmPlacement::Shared ? "shared" : "device") << "\n";
+            // The NUMA split runs on sub-device queues, whose kernels this
+            // warm-up does not cover.
+            std::shared_future<KernelBundle> kernelsReady;
+            if (!splitNuma) {
+                kernelsReady = warmUpKernels(q);
+            }
+            if (tokenizer == "host" && keys == "ids") {
+                wordCountPairs = countHostEncoded(q, targetFilePath, minimumWordLength, numThreads, useCache,
+                                                  kernelsReady);
+                ranked = true;
+            } else if (tokenizer == "host" && keys == "bucketed") {
+                wordCountPairs = countHostBucketed(q, targetFilePath, minimumWordLength, kernelsReady);
+            } else if (tokenizer == "host") {
+                wordCountPairs = countHostTokenized(q, targetFilePath, minimumWordLength, memory == "usm", placement,
+                                                    kernelsReady);
+            } else if (splitNuma) {
+                wordCountPairs = countCorpusPerNumaDomain(q, targetFilePath, minimumWordLength,
+                                                          chunkMegabytes * 1024 * 1024, tableSlots);
+            } else {
+                SyclHashTableEngine counter(q, chunkMegabytes * 1024 * 1024, tableSlots, kernelsReady);
+                counter.ingestFile(targetFilePath, minimumWordLength);
+                counter.finish();
+                wordCountPairs = counter.results();
+            }
+        } catch (const std::runtime_error &e) {
+            cerr << "Error: " << e.what() << "\n";
+            exit(EXIT_FAILURE);
+        } catch (...) {
+            std::cout << "Failure" << "\n";
+            std::terminate();
+        }
+#endif
+    }
+
+    if (!ranked) {
+        sort(wordCountPairs.begin(), wordCountPairs.end(), compareWordCounts);
     }
-    sort(wordCountPairs.begin(), wordCountPairs.end(), compareWordCounts);
 
     cout << "Word counts:" << "\n";
     for (const auto &pair : wordCountPairs) {
@@ -180,4 +1542,3 @@ int main() {
 
     return 0;
 }
-
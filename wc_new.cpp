@@ -1,7 +1,12 @@
+#include "counting_engine.h"
+#include "device_tokens.h"
+#include "sorted_dictionary.h"
+#include "word_loader.h"
 #include <CL/sycl.hpp>
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <fstream>
 #include <algorithm>
@@ -11,104 +16,105 @@ using namespace sycl;
 using namespace std;
 
 
+// Bits are packed into 32-bit words so the array can be handed to a device
+// as a plain contiguous buffer (vector<bool> has no data()).
 class BloomFilter {
 public:
-    BloomFilter(size_t size) : size(size), bit_vector(size) {}
+    BloomFilter(size_t size) : size(size), bit_vector((size + 31) / 32, 0) {}
 
-    void insert(const string &word) {
-        size_t index = hash_function(word) % size;
-        bit_vector[index] = true;
+    void insert(string_view word) {
+        size_t index = hash_function(word.data(), word.size()) % size;
+        bit_vector[index / 32] |= 1u << (index % 32);
     }
 
-    buffer<bool, 1> get_buffer() {
-        return buffer<bool, 1>(bit_vector.data(), range<1>(bit_vector.size()));
+    buffer<uint32_t, 1> get_buffer() {
+        return buffer<uint32_t, 1>(bit_vector.data(), range<1>(bit_vector.size()));
     }
 
-private:
-    size_t size;
-    vector<bool> bit_vector;
+    size_t get_size() const { return size; }
 
-    size_t hash_function(const string &str) {
-        size_t hash = 0;
-        for (char c : str) {
-            hash = hash * 31 + c;
-        }
-        return hash;
+    // Usable on host and inside kernels, so insert and lookup agree.
+    static uint64_t hash_function(const char *str, uint32_t length) {
+        return fnv1a64(str, length);
     }
-};
-
-template <typename Container>
-void loadContainer(const string &path, size_t minimumWordLength, Container &data) {
-    string line;
-    ifstream inputFile;
-
-    inputFile.open(path);
-
-    if (inputFile.is_open()) {
-        while (getline(inputFile, line)) {
-            transform(line.begin(), line.end(), line.begin(), ::toupper);
-            if (line.length() >= minimumWordLength && line.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ") == string::npos) {
-                data.insert(data.end(), line);
-            }
-        }
-    } else {
-        cerr << "Error: Could not open file '" << path << "'." << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    inputFile.close();
-}
 
+private:
+    size_t size;
+    vector<uint32_t> bit_vector;
+};
 
 int main() {
     string dictionaryPath = "wordlist.txt";
     string hamletPath = "hamlet_test.txt";
     size_t wordSize = 1;
 
-    set<string> dictionary;
-    vector<string> hamletVector;
-    loadContainer(dictionaryPath, wordSize, dictionary);
-    loadContainer(hamletPath, wordSize, hamletVector);
+    WordLoader::LoadedWords dictionaryFile = WordLoader::loadWords(dictionaryPath, wordSize, WordLoader::Tokens);
+    const vector<string_view> &dictionaryWords = dictionaryFile.tokens;
+    WordLoader::LoadedWords hamlet = WordLoader::loadWords(hamletPath, wordSize, WordLoader::Tokens);
+    const vector<string_view> &hamletVector = hamlet.tokens;
+    SortedDictionary::EytzingerDictionary dictionary(dictionaryWords);
 
     BloomFilter bf(12400001);
 
-    for (const auto &word : dictionary) {
+    for (string_view word : dictionaryWords) {
         bf.insert(word);
     }
 
+    // Nothing to count, and zero-sized buffers are not valid kernel arguments.
+    // Every accepted token is at least wordSize >= 1 bytes, so a non-empty
+    // corpus always has bytes to upload.
+    if (hamletVector.empty()) {
+        return 0;
+    }
+
     queue q;
 
-    vector<int> wordCount(hamletVector.size(), 0);
-
-    buffer<int, 1> countBuf(wordCount.data(), range<1>(wordCount.size()));
-    buffer<bool, 1> bfBuf = bf.get_buffer();
-
-    q.submit([&](handler &h) {
-        auto count = countBuf.get_access<access::mode::read_write>(h);
-        auto bf_data = bfBuf.get_access<access::mode::read>(h);
-
-        auto hash_function = [](const string &str) {
-            size_t hash = 0;
-            for (char c : str) {
-                hash = hash * 31 + c;
-            }
-            return hash;
-        };
-
-        h.parallel_for<class word_count_kernel>(range<1>(hamletVector.size()), [=](id<1> i) {
-            const auto &word = hamletVector[i];
-            size_t index = hash_function(word) % bfBuf.get_count();
-            if (bf_data[index]) {
-                count[i]++;
-            }
+    FlatTokens tokens = flattenTokens(hamletVector);
+    vector<int> wordCount(tokens.size(), 0);
+    size_t bfSize = bf.get_size();
+
+    {
+        buffer<char, 1> bytesBuf(tokens.bytes.data(), range<1>(tokens.bytes.size()));
+        buffer<uint32_t, 1> offsetsBuf(tokens.offsets.data(), range<1>(tokens.offsets.size()));
+        buffer<int, 1> countBuf(wordCount.data(), range<1>(wordCount.size()));
+        buffer<uint32_t, 1> bfBuf = bf.get_buffer();
+
+        q.submit([&](handler &h) {
+            auto bytes = bytesBuf.get_access<access::mode::read>(h);
+            auto offsets = offsetsBuf.get_access<access::mode::read>(h);
+            auto count = countBuf.get_access<access::mode::read_write>(h);
+            auto bf_data = bfBuf.get_access<access::mode::read>(h);
+
+            h.parallel_for<class word_count_kernel>(range<1>(tokens.size()), [=](id<1> i) {
+                uint32_t begin = offsets[i];
+                uint32_t length = offsets[i + 1] - begin;
+                size_t index = BloomFilter::hash_function(&bytes[begin], length) % bfSize;
+                if (bf_data[index / 32] & (1u << (index % 32))) {
+                    count[i]++;
+                }
+            });
         });
-    });
 
-    q.wait();
+        q.wait();
+    }
 
+    // Bloom hits are confirmed against the exact dictionary, so false
+    // positives never reach the counts.
+    vector<string_view> hits;
     for (size_t i = 0; i < hamletVector.size(); i++) {
-        cout << hamletVector[i] << " : " << wordCount[i] << endl;
+        if (wordCount[i] > 0 && dictionary.contains(hamletVector[i])) {
+            hits.push_back(hamletVector[i]);
+        }
+    }
+
+    string engineName = CountingEngines::chooseEngine(CountingEngines::profileTokens(hits, false));
+    unique_ptr<CountingEngines::CountingEngine> counter = CountingEngines::makeHostEngine(engineName);
+    counter->ingest(hits);
+    counter->finish();
+
+    for (const auto &[word, count] : counter->results()) {
+        cout << word << " : " << count << endl;
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,78 @@
+#ifndef WORD_ARENA_H
+#define WORD_ARENA_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "hugepage.h"
+
+// Monotonic arena for token bytes. Words are copied into large slabs and
+// handed out as string_views, so loading a corpus costs a few slab
+// allocations instead of one heap string per token, and tearing it down
+// frees the slabs and nothing else. Sized from the input, a corpus usually
+// fits in the first slab. It is also a std::pmr::memory_resource, so pmr
+// containers can draw from the same slabs.
+namespace WordArena {
+
+class Arena : public std::pmr::memory_resource {
+public:
+    explicit Arena(size_t initialBytes = 64 * 1024) : nextSlabBytes(std::max<size_t>(initialBytes, 64)) {}
+
+    ~Arena() override {
+        for (const auto& [slab, bytes] : slabs) {
+            HugePages::deallocate(slab, bytes);
+        }
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // A copy of word that lives as long as the arena.
+    std::string_view intern(std::string_view word) {
+        char* copy = static_cast<char*>(allocate(std::max<size_t>(word.size(), 1), 1));
+        std::memcpy(copy, word.data(), word.size());
+        return std::string_view(copy, word.size());
+    }
+
+    size_t numSlabs() const { return slabs.size(); }
+
+private:
+    std::vector<std::pair<void*, size_t>> slabs;
+    char* cursor = nullptr;
+    char* end = nullptr;
+    size_t nextSlabBytes;
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        uintptr_t start = alignUp(reinterpret_cast<uintptr_t>(cursor), alignment);
+        if (cursor == nullptr || start + bytes > reinterpret_cast<uintptr_t>(end)) {
+            size_t slabBytes = std::max(nextSlabBytes, bytes + alignment);
+            cursor = static_cast<char*>(HugePages::allocate(slabBytes));
+            end = cursor + slabBytes;
+            slabs.emplace_back(cursor, slabBytes);
+            nextSlabBytes = slabBytes * 2;
+            start = alignUp(reinterpret_cast<uintptr_t>(cursor), alignment);
+        }
+        cursor = reinterpret_cast<char*>(start + bytes);
+        return reinterpret_cast<void*>(start);
+    }
+
+    // Memory comes back all at once, in the destructor.
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    static uintptr_t alignUp(uintptr_t address, size_t alignment) {
+        return (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+    }
+};
+
+}  // namespace WordArena
+
+#endif
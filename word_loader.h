@@ -0,0 +1,89 @@
+#ifndef WORD_LOADER_H
+#define WORD_LOADER_H
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "flat_word_map.h"
+#include "word_arena.h"
+
+// One-word-per-line loader shared by the Bloom tools. A line is upper-cased
+// and kept when it is at least minimumWordLength letters long. The file is read
+// once, and only the views the caller asks for are built from it.
+//
+// The tokens and distinct views hold string_views into the arena of the
+// LoadedWords that returned it, so they stay valid for as long as that object
+// lives. The counts map keeps its own copies of the words.
+namespace WordLoader {
+
+enum View : unsigned {
+    Tokens = 1 << 0,    // every accepted line, in file order
+    Distinct = 1 << 1,  // each accepted word once
+    Counts = 1 << 2,    // occurrences per accepted word
+};
+
+struct LoadedWords {
+    std::unique_ptr<WordArena::Arena> arena;
+    std::vector<std::string_view> tokens;
+    std::unordered_set<std::string_view> distinct;
+    FlatMap::FlatWordMap<int> counts;
+};
+
+// The file's size, which bounds the bytes its words can take up; the arena
+// starts with one slab that large.
+inline size_t fileBytes(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+}
+
+inline LoadedWords loadWords(const std::string& path, size_t minimumWordLength, unsigned views) {
+    LoadedWords loaded;
+    std::ifstream inputFile(path);
+    if (!inputFile.is_open()) {
+        std::cerr << "Error: Could not open file '" << path << "'." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    loaded.arena = std::make_unique<WordArena::Arena>(fileBytes(path));
+
+    std::string line;
+    while (getline(inputFile, line)) {
+        std::transform(line.begin(), line.end(), line.begin(), ::toupper);
+        if (line.length() < minimumWordLength || line.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ") != std::string::npos) {
+            continue;
+        }
+
+        if (views & Counts) {
+            loaded.counts[line]++;
+        }
+
+        // With a distinct set to look words up in, repeats share the first
+        // occurrence's bytes; a bare token stream skips the lookup.
+        std::string_view word;
+        if (views & Distinct) {
+            auto found = loaded.distinct.find(line);
+            word = found != loaded.distinct.end() ? *found : *loaded.distinct.insert(loaded.arena->intern(line)).first;
+        }
+        if (views & Tokens) {
+            if (word.data() == nullptr) {
+                word = loaded.arena->intern(line);
+            }
+            loaded.tokens.push_back(word);
+        }
+    }
+
+    return loaded;
+}
+
+}  // namespace WordLoader
+
+#endif